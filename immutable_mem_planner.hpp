@@ -16,19 +16,35 @@
 #include <stdexcept>
 #include <mutex>
 #include <atomic>
+#include <string>
+#include <stdarg.h>
 
 #include "mem_types.hpp"
 #include "mem_config.hpp"
 #include "tools.hpp"
+#include "mem_task_pool.hpp"
 #include "mem_counter.hpp"
 #include "mem_segment.hpp"
 #include "mem_check_point.hpp"
 #include "mem_locators.hpp"
+#include "mem_addr_index.hpp"
 #include "mem_locator.hpp"
 
+#define NO_SEGMENT 0xFFFFFFFF
+
+// Plans a read only region (rom, input), all addresses of region are rows, also addresses not
+// accessed between accessed ones (intermediate rows).
+//
+// Region is split in work units of consecutive segments planned concurrently. Rows before each
+// address (intermediate rows included) only depend on addresses, so a unit starts on the address
+// where its first segment is opened, with state after previous address (last chunk of previous
+// address is reference). Segments before its first one are discarded, and unit stops when its
+// last segment is closed. Segments are same than planning whole region on one thread.
 class ImmutableMemPlanner {
 private:
     uint32_t rows_by_segment;
+    uint32_t from_addr;
+    uint32_t mb_size;
     uint32_t from_page;
     uint32_t to_page;
     uint32_t rows_available;
@@ -37,10 +53,6 @@ private:
     uint32_t reference_skip;
     uint32_t current_chunk;
     uint32_t last_addr;
-    #ifndef MEM_CHECK_POINT_MAP
-    uint32_t *chunk_table;
-    uint32_t limit_pos;
-    #endif
     #ifdef SEGMENT_STATS
     uint32_t max_chunks;
     uint32_t large_segments;
@@ -50,17 +62,22 @@ private:
     MemLocator locators[MAX_CHUNKS];
     uint32_t locators_count;
     #endif
+    MemSegmentArena arena;                      // segments of planner (unit) of run
     MemSegment *current_segment;
-    #ifndef MEM_CHECK_POINT_MAP
-    MemSegmentHashTable *hash_table;
-    #endif
     std::vector<MemSegment *> segments;
+    uint32_t segment_id;                        // current segment
+    uint32_t first_segment;                     // segments of unit [first_segment, end_segment)
+    uint32_t end_segment;
+    bool completed;
+    std::string debug_log;
+    std::vector<ImmutableMemPlanner *> units;   // planners of work units after first one
+    uint32_t units_used;
+    uint32_t planned_segments;
+    uint64_t elapsed;
 
 public:
-    ImmutableMemPlanner(uint32_t rows, uint32_t from_addr, uint32_t mb_size):rows_by_segment(rows) {
-        #ifndef MEM_CHECK_POINT_MAP
-        hash_table = new MemSegmentHashTable(MAX_CHUNKS);   // 2^18 * 2^18 = 2^36   // 2^14 * 2^18 = 2^32
-        #endif
+    ImmutableMemPlanner(uint32_t rows, uint32_t from_addr, uint32_t mb_size)
+    :rows_by_segment(rows), from_addr(from_addr), mb_size(mb_size) {
         rows_available = rows;
         reference_addr_chunk = NO_CHUNK_ID;
         reference_addr = 0;
@@ -69,11 +86,7 @@ public:
         #ifdef DIRECT_MEM_LOCATOR
         locators_count = 0;
         #endif
-        #ifdef MEM_CHECK_POINT_MAP
-        current_segment = new MemSegment();
-        #else
-        current_segment = new MemSegment(hash_table);
-        #endif
+        current_segment = arena.create<MemSegment>(&arena);
         from_page = MemCounter::addr_to_page(from_addr);
         to_page = MemCounter::addr_to_page(from_addr + (mb_size * 1024 * 1024) - 1);
         if (MemCounter::page_to_addr(from_page) != from_addr) {
@@ -81,58 +94,168 @@ public:
             msg << "MemPlanner::constructor: from_addr " << std::hex << from_addr << " not aligned to page " << std::dec << from_page;
             throw std::runtime_error(msg.str());
         }
-        #ifndef MEM_CHECK_POINT_MAP
-        chunk_table = (uint32_t *)malloc(MAX_CHUNKS * sizeof(uint32_t));
-        memset(chunk_table, 0, MAX_CHUNKS * sizeof(uint32_t));
-        limit_pos = 0x00010000;
-        #endif
         #ifdef SEGMENT_STATS
         max_chunks = 0;
         tot_chunks = 0;
         large_segments = 0;
         #endif
+        segment_id = 0;
+        first_segment = 0;
+        end_segment = NO_SEGMENT;
+        completed = false;
+        units_used = 0;
+        planned_segments = 0;
+        elapsed = 0;
     }
     ~ImmutableMemPlanner() {
+        for (auto unit: units) {
+            delete unit;
+        }
+    }
+    // prepares planner for a new trace, segments of previous trace are released with arena
+    void reset() {
+        segments.clear();
+        arena.reset();
+        current_segment = arena.create<MemSegment>(&arena);
+        rows_available = rows_by_segment;
+        reference_addr_chunk = NO_CHUNK_ID;
+        reference_addr = 0;
+        reference_skip = 0;
+        current_chunk = NO_CHUNK_ID;
+        #ifdef DIRECT_MEM_LOCATOR
+        locators_count = 0;
+        #endif
+        #ifdef SEGMENT_STATS
+        max_chunks = 0;
+        tot_chunks = 0;
+        large_segments = 0;
+        #endif
+        segment_id = 0;
+        first_segment = 0;
+        end_segment = NO_SEGMENT;
+        completed = false;
+        debug_log.clear();
+        for (auto unit: units) {
+            unit->reset();
+        }
+    }
+    // intermediate rows between two consecutive accessed addresses
+    static inline uint32_t get_intermediate_rows(uint32_t last_addr, uint32_t addr) {
+        return (addr - last_addr) > 8 ? (addr - last_addr - 8) >> 3 : 0;
     }
-    void execute(const std::vector<MemCounter *> &workers) {
-        uint32_t addr = 0;
-        uint32_t offset;
-        uint32_t last_offset;
+    void execute(const MemAddrIndex &index, uint32_t threads = MEM_IMMUTABLE_PLAN_THREADS) {
+        uint64_t init = get_usec();
         printf("BEGIN pages:(%d-%d)\n", from_page, to_page);
-        last_addr = MemCounter::page_to_addr(from_page);
+        const uint32_t from_entry = index.get_page_entry(from_page);
+        const uint32_t to_entry = index.get_page_entry(to_page);
         for (uint32_t page = from_page; page < to_page; ++page) {
-            get_offset_limits(workers, page, offset, last_offset);
-            printf("##### page:%d offsets:0x%08X-0x%08X pages:(%d-%d)\n", page, offset, last_offset, from_page, to_page);
-            addr = MemCounter::offset_to_addr(offset, 0);
-            for (;offset <= last_offset; ++offset) {
-                // printf("offset:0x%08X page:%d addr:0x%08X segments:%d\n", offset, page, addr, segments.size());
-                for (uint32_t i = 0; i < MAX_THREADS; ++i, addr += 8) {
-                    uint32_t pos = workers[i]->get_addr_table(offset);
-                    if (pos == 0) continue;
-                    uint32_t cpos = workers[i]->get_initial_pos(pos);
-                    while (cpos != 0) {
-                        uint32_t chunk_id = workers[i]->get_pos_value(cpos);
-                        uint32_t count = workers[i]->get_pos_value(cpos+1);
-                        if (to_page == 1) printf("add_to_current_segment(%d, 0x%08X, %d)\n", chunk_id, addr, count);
-                        add_to_current_segment(chunk_id, addr, count);
-                        if (cpos == pos) break;
-                        cpos = workers[i]->get_next_pos(cpos+1);
-                    }
-                }
+            printf("##### page:%d entries:%d-%d pages:(%d-%d)\n", page, index.get_page_entry(page), index.get_page_entry(page + 1), from_page, to_page);
+        }
+        uint64_t total = 0;
+        uint32_t addr = MemCounter::page_to_addr(from_page);
+        for (uint32_t entry_pos = from_entry; entry_pos < to_entry; ++entry_pos) {
+            const MemAddrEntry &entry = index.get_entry(entry_pos);
+            total += get_intermediate_rows(addr, entry.addr) + entry.count;
+            addr = entry.addr;
+        }
+        const uint64_t total_segments = (total + rows_by_segment - 1) / rows_by_segment;
+        const uint32_t units_count = std::max(1U, (uint32_t)std::min((uint64_t)parallel_threads(threads), total_segments));
+
+        // first entry and rows before it of each unit, entry where first segment of unit is opened
+        std::vector<uint32_t> unit_entry(units_count + 1, to_entry);
+        std::vector<uint64_t> unit_rows(units_count, 0);
+        unit_entry[0] = from_entry;
+        uint32_t unit = 1;
+        uint64_t rows_done = 0;
+        addr = MemCounter::page_to_addr(from_page);
+        for (uint32_t entry_pos = from_entry; entry_pos < to_entry && unit < units_count; ++entry_pos) {
+            const MemAddrEntry &entry = index.get_entry(entry_pos);
+            const uint64_t entry_rows = get_intermediate_rows(addr, entry.addr) + entry.count;
+            while (unit < units_count && rows_done + entry_rows > get_unit_segment(unit, units_count, total) * rows_by_segment) {
+                unit_entry[unit] = entry_pos;
+                unit_rows[unit] = rows_done;
+                ++unit;
             }
+            rows_done += entry_rows;
+            addr = entry.addr;
+        }
+        while (units.size() < units_count - 1) {
+            units.push_back(new ImmutableMemPlanner(rows_by_segment, from_addr, mb_size));
+        }
+        units_used = units_count;
+        run_parallel(units_count, [&](uint32_t unit) {
+            ImmutableMemPlanner *planner = unit == 0 ? this : units[unit - 1];
+            const uint32_t end = (unit + 1) < units_count ? get_unit_segment(unit + 1, units_count, total) : NO_SEGMENT;
+            planner->execute_unit(index, unit_entry[unit], to_entry, unit_rows[unit], get_unit_segment(unit, units_count, total), end);
+        });
+        printf("%s", debug_log.c_str());
+        debug_log.clear();
+        for (uint32_t unit = 1; unit < units_count; ++unit) {
+            ImmutableMemPlanner *planner = units[unit - 1];
+            printf("%s", planner->debug_log.c_str());
+            planner->debug_log.clear();
+            segments.insert(segments.end(), planner->segments.begin(), planner->segments.end());
+            planner->segments.clear();
+            #ifdef SEGMENT_STATS
+            max_chunks = std::max(max_chunks, planner->max_chunks);
+            large_segments += planner->large_segments;
+            tot_chunks += planner->tot_chunks;
+            #endif
         }
         printf("END pages:(%d-%d)\n", from_page, to_page);
-        close_last_segment();
+        planned_segments = segments.size();
+        elapsed = get_usec() - init;
     }
-
-    void get_offset_limits(const std::vector<MemCounter *> &workers, uint32_t page, uint32_t &first_offset, uint32_t &last_offset) {
-        first_offset = workers[0]->first_offset[page];
-        last_offset = workers[0]->last_offset[page];
-        for (int i = 1; i < MAX_THREADS; ++i) {
-            first_offset = std::min(first_offset, workers[i]->first_offset[page]);
-            last_offset = std::max(last_offset, workers[i]->last_offset[page]);
+    uint32_t get_unit_segment(uint32_t unit, uint32_t units_count, uint64_t total_rows) const {
+        const uint64_t total_segments = (total_rows + rows_by_segment - 1) / rows_by_segment;
+        return total_segments * unit / units_count;
+    }
+    // plans entries from first entry of unit (rows_done before it) until segment end_segment is
+    // opened, only segments from first_segment are kept
+    void execute_unit(const MemAddrIndex &index, uint32_t from_entry, uint32_t to_entry, uint64_t rows_done, uint32_t first_segment, uint32_t end_segment) {
+        this->first_segment = first_segment;
+        this->end_segment = end_segment;
+        completed = false;
+        segment_id = rows_done == 0 ? 0 : (rows_done - 1) / rows_by_segment;
+        rows_available = rows_done == 0 ? rows_by_segment : (uint64_t)rows_by_segment * (segment_id + 1) - rows_done;
+        if (from_entry > index.get_page_entry(from_page)) {
+            // state after previous address, its last chunk is reference
+            const MemAddrEntry &entry = index.get_entry(from_entry - 1);
+            const MemCounter *worker = index.get_counter(entry);
+            set_current_chunk(worker->get_pos_chunk(entry.pos));
+            set_reference(current_chunk, entry.addr);
+            reference_skip = worker->get_pos_count(entry.pos);
+            last_addr = entry.addr;
+        } else {
+            last_addr = MemCounter::page_to_addr(from_page);
+        }
+        for (uint32_t entry_pos = from_entry; entry_pos < to_entry && !completed; ++entry_pos) {
+            const MemAddrEntry &entry = index.get_entry(entry_pos);
+            const MemCounter *worker = index.get_counter(entry);
+            uint32_t cpos = worker->get_initial_pos(entry.pos);
+            while (cpos != 0) {
+                uint32_t chunk_id = worker->get_pos_chunk(cpos);
+                uint32_t count = worker->get_pos_count(cpos);
+                debug("add_to_current_segment(%d, 0x%08X, %d)\n", chunk_id, entry.addr, count);
+                add_to_current_segment(chunk_id, entry.addr, count);
+                if (cpos == entry.pos) break;
+                cpos = worker->get_next_pos(cpos);
+            }
+        }
+        if (!completed) {
+            close_last_segment();
         }
     }
+    // debug of first page (rom), kept by unit and printed in unit order
+    void debug(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+        if (to_page != 1 || segment_id < first_segment || segment_id >= end_segment) return;
+        char line[256];
+        va_list args;
+        va_start(args, format);
+        vsnprintf(line, sizeof(line), format, args);
+        va_end(args);
+        debug_log += line;
+    }
 
     void add_to_current_segment(uint32_t chunk_id, uint32_t addr, uint32_t count) {
         set_current_chunk(chunk_id);
@@ -150,7 +273,7 @@ public:
         current_chunk = chunk_id;
     }
     void close_last_segment() {
-        if (to_page == 1) printf("CLOSE_LAST_SEGMENT SEGMENTS[%ld]\n", segments.size());
+        debug("CLOSE_LAST_SEGMENT SEGMENTS[%d]\n", segment_id);
         if (rows_available < rows_by_segment) {
             close_segment(true);
         }/* else if (segments.size() > 0) {
@@ -160,6 +283,12 @@ public:
     void close_segment(bool last = false) {
         // current_segment->is_last_segment = last;
         // printf("MemPlanner::close_segment: %d chunks from_page:%d\n", current_segment->chunks.size(), from_page);
+        if (segment_id < first_segment || completed) {
+            // opened by a previous unit
+            ++segment_id;
+            current_segment = arena.create<MemSegment>(&arena);
+            return;
+        }
         #ifdef SEGMENT_STATS
         uint32_t segment_chunks = current_segment->size();
         if (segment_chunks > max_chunks) {
@@ -171,26 +300,19 @@ public:
         tot_chunks += segment_chunks;
         #endif
 
-        if (to_page == 1) printf("SEGMENTS[%ld] ADD\n", segments.size());
+        debug("SEGMENTS[%d] ADD\n", segment_id);
 
+        current_segment->close();
         segments.emplace_back(current_segment);
-        #ifdef MEM_CHECK_POINT_MAP
-        current_segment = new MemSegment();
-        #else
-        current_segment = new MemSegment(hash_table);
-        #endif
+        if (++segment_id == end_segment) {
+            completed = true;
+        }
+        current_segment = arena.create<MemSegment>(&arena);
     }
     void open_segment(uint32_t intermediate_skip) {
-        #ifndef MEM_CHECK_POINT_MAP
-        limit_pos = (segments.size() + 1) << 16;
-        #endif
         close_segment(false);
         if (reference_addr_chunk != NO_CHUNK_ID) {
-            #ifdef MEM_CHECK_POINT_MAP
             current_segment->add_or_update(reference_addr_chunk, reference_addr, reference_skip, 0);
-            #else
-            current_segment->add_or_update(hash_table, reference_addr_chunk, reference_addr, reference_skip, 0);
-            #endif
         }
         rows_available = rows_by_segment;
         // printf("MemPlanner::open_segment: rows_available: %d from_page:%d\n", rows_available, from_page);
@@ -199,11 +321,7 @@ public:
         add_chunk_to_segment(current_chunk, addr, 1, 0);
     }
     void add_chunk_to_segment(uint32_t chunk_id, uint32_t addr, uint32_t count, uint32_t skip) {
-        #ifdef MEM_CHECK_POINT_MAP
         current_segment->add_or_update(chunk_id, addr, skip, count);
-        #else
-        current_segment->add_or_update(hash_table, chunk_id, addr, skip, count);
-        #endif
     }
     void preopen_segment(uint32_t addr, uint32_t intermediate_rows) {
         if (rows_available == 0) {
@@ -289,13 +407,23 @@ public:
 
     void collect_segments(MemSegments &mem_segments) {
         uint32_t segment_id = 0;
+        mem_segments.reserve(segments.size());
         for (auto segment :segments) {
             mem_segments.set(segment_id++, segment);
         }
+        mem_segments.set_count(segment_id);
         segments.clear();
     }
+    // bytes served and blocks allocated by arenas of planner and its units on this run
+    void add_arena_stats(uint64_t &bytes, uint32_t &mallocs) const {
+        bytes += arena.get_bytes_served();
+        mallocs += arena.get_mallocs();
+        for (auto unit: units) {
+            unit->add_arena_stats(bytes, mallocs);
+        }
+    }
     void stats() {
-
+        printf("IMMUTABLE_PLANNER|pages: %2d-%2d|units: %2d|segments: %4d|%7.2f ms\n", from_page, to_page, units_used, planned_segments, elapsed / 1000.0);
     }
 };
 #endif
\ No newline at end of file
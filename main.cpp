@@ -79,7 +79,7 @@ int main(int argc, const char *argv[]) {
     // }
     MemTest mem_test;
     mem_test.load(argc > 1 ? argv[1] : "../bus_data.org/mem_count_data");
-    mem_test.execute();
+    mem_test.execute(argc > 2 ? atoi(argv[2]) : 1);
     printf("END\n");
 }
 
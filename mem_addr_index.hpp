@@ -0,0 +1,163 @@
+#ifndef __MEM_ADDR_INDEX_HPP__
+#define __MEM_ADDR_INDEX_HPP__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include "mem_types.hpp"
+#include "mem_config.hpp"
+#include "mem_partition.hpp"
+#include "mem_counter.hpp"
+#include "mem_occupancy.hpp"
+#include "tools.hpp"
+#include "mem_task_pool.hpp"
+
+// entry count is total count of address (get_count_table), without table it's a slot position
+#ifndef USE_ADDR_COUNT_TABLE
+#error "MemAddrIndex requires USE_ADDR_COUNT_TABLE"
+#endif
+
+struct MemAddrEntry {
+    uint32_t addr;
+    uint32_t pos;           // address table pos of address (last slot entry)
+    uint32_t count;         // rows of address
+    uint32_t counter;       // counter (partition) with slots of address
+};
+
+// Addresses counted by all counters sorted by address, built after count phase. Entries are
+// grouped by row block (CSR), block_entry[block] is first entry of block, pages start on a
+// block. Planners walk entries sequentially instead of probing address tables of each counter
+// on each offset, and locators are positions of entries.
+//
+// Build is parallel by subranges of blocks: entries by block are popcounts of counter
+// occupancy bitmaps (combined bitmap of block is built on same pass), an exclusive scan gives
+// first entry of each block, and each subrange fills its entries walking used offsets of
+// combined bitmap.
+class MemAddrIndex {
+private:
+    const MemPartitionLayout layout;
+    MemOccupancy occupancy;
+    std::vector<MemCounter *> workers;
+    MemAddrEntry *entries;                      // lazy, one by address of table at most
+    const uint64_t max_entries;
+    uint32_t entries_count;
+    std::vector<uint32_t> block_entry;
+    const uint32_t blocks;
+    uint32_t first_offset[MAX_PAGES];           // used offsets by page, of any counter
+    uint32_t last_offset[MAX_PAGES];
+    uint64_t elapsed_us;
+public:
+    MemAddrIndex(const MemPartitionLayout &layout)
+    : layout(layout), occupancy(layout), max_entries((uint64_t)layout.table_size * layout.partitions),
+      entries_count(0), blocks(layout.table_size >> MEM_ROW_BLOCK_BITS), elapsed_us(0) {
+        entries = (MemAddrEntry *)lazy_alloc(max_entries * sizeof(MemAddrEntry));
+        block_entry.resize(blocks + 1, 0);
+    }
+    ~MemAddrIndex() {
+        lazy_free(entries, max_entries * sizeof(MemAddrEntry));
+    }
+    // counters must be completed, previous index is discarded
+    void build(const std::vector<MemCounter *> &workers, uint32_t threads = MEM_INDEX_THREADS) {
+        uint64_t init = get_usec();
+        this->workers = workers;
+        for (uint32_t page = 0; page < MAX_PAGES; ++page) {
+            first_offset[page] = workers[0]->first_offset[page];
+            last_offset[page] = workers[0]->last_offset[page];
+            for (uint32_t i = 1; i < workers.size(); ++i) {
+                first_offset[page] = std::min(first_offset[page], workers[i]->first_offset[page]);
+                last_offset[page] = std::max(last_offset[page], workers[i]->last_offset[page]);
+            }
+        }
+        const uint32_t subranges = std::max(1U, std::min(parallel_threads(threads), blocks / MEM_INDEX_MIN_BLOCKS));
+        auto get_subrange = [this, subranges](uint32_t index, uint32_t &from, uint32_t &to) {
+            from = (uint64_t)blocks * index / subranges;
+            to = (uint64_t)blocks * (index + 1) / subranges;
+        };
+        run_parallel(subranges, [&](uint32_t index) {
+            uint32_t from, to;
+            get_subrange(index, from, to);
+            for (uint32_t block = from; block < to; ++block) {
+                if (!is_used_block(block)) {
+                    occupancy.clear_block(block);
+                    block_entry[block] = 0;
+                    continue;
+                }
+                block_entry[block] = occupancy.build_block(block, workers);
+            }
+        });
+        uint32_t total = 0;
+        for (uint32_t block = 0; block < blocks; ++block) {
+            const uint32_t count = block_entry[block];
+            block_entry[block] = total;
+            total += count;
+        }
+        block_entry[blocks] = total;
+        entries_count = total;
+        run_parallel(subranges, [&](uint32_t index) {
+            uint32_t from, to;
+            get_subrange(index, from, to);
+            for (uint32_t block = from; block < to; ++block) {
+                if (is_used_block(block)) fill_block(block);
+            }
+        });
+        elapsed_us = get_usec() - init;
+    }
+    // block has offsets between used limits of its page (bitmaps of other blocks aren't read)
+    inline bool is_used_block(uint32_t block) const {
+        const uint32_t first = block << MEM_ROW_BLOCK_BITS;
+        const uint32_t page = first >> layout.page_bits;
+        return first_offset[page] <= last_offset[page] && first <= last_offset[page] &&
+               first + MEM_ROW_BLOCK_SIZE - 1 >= first_offset[page];
+    }
+    void fill_block(uint32_t block) {
+        const uint32_t partitions = workers.size();
+        const uint32_t first = block << MEM_ROW_BLOCK_BITS;
+        const uint32_t last = first + MEM_ROW_BLOCK_SIZE - 1;
+        MemAddrEntry *entry = entries + block_entry[block];
+        for (uint32_t offset = occupancy.next(first, last); offset <= last; offset = occupancy.next(offset + 1, last)) {
+            const uint32_t addr = workers[0]->offset_to_addr(offset, 0);
+            const uint32_t fold = workers[0]->lane_fold(offset);
+            // lanes in address order, counter of lane is lane ^ fold
+            for (uint32_t lane = 0; lane < partitions; ++lane) {
+                const MemCounter *worker = workers[lane ^ fold];
+                const uint32_t pos = worker->get_addr_table(offset);
+                if (pos == 0) continue;
+                *entry++ = MemAddrEntry{addr + lane * 8, pos, worker->get_count_table(offset), lane ^ fold};
+            }
+        }
+    }
+    inline const MemAddrEntry &get_entry(uint32_t index) const {
+        return entries[index];
+    }
+    inline const MemCounter *get_counter(const MemAddrEntry &entry) const {
+        return workers[entry.counter];
+    }
+    // entries of block are [get_block_entry(block), get_block_entry(block + 1))
+    inline uint32_t get_block_entry(uint32_t block) const {
+        return block_entry[block];
+    }
+    inline uint32_t get_page_entry(uint32_t page) const {
+        return block_entry[(page * layout.page_size) >> MEM_ROW_BLOCK_BITS];
+    }
+    uint64_t get_block_rows(uint32_t block) const {
+        uint64_t rows = 0;
+        for (auto worker: workers) {
+            rows += worker->get_block_rows(block);
+        }
+        return rows;
+    }
+    const MemPartitionLayout &get_layout() const {
+        return layout;
+    }
+    uint32_t size() const {
+        return entries_count;
+    }
+    uint64_t get_elapsed_us() const {
+        return elapsed_us;
+    }
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include "mem_config.hpp"
 #include "mem_types.hpp"
 #include "mem_context.hpp"
+#include "mem_trace_codec.hpp"
 #include "tools.hpp"
 #include <vector>
 #include <assert.h>
@@ -28,6 +29,8 @@ private:
     uint32_t skip;
     uint32_t rows;
     uint32_t elapsed_ms;
+    MemWaitStats wait_stats;
+    MemTraceDecoder decoder;
 public:
     MemAlignCounter(uint32_t rows, MemContext *context) :context(context), rows(rows) {
         count = 0;
@@ -37,11 +40,28 @@ public:
     }
     ~MemAlignCounter() {
     }
+    // checkpoints keep their capacity for next trace
+    void reset() {
+        checkpoints.clear();
+        count = 0;
+        available_rows = 0;
+        segment_id = -1;
+        skip = 0;
+        elapsed_ms = 0;
+        wait_stats.clear();
+    }
     void execute() {
         uint64_t init = get_usec();
         const MemChunk *chunk;
         uint32_t chunk_id = 0;
-        while ((chunk = context->get_chunk(chunk_id)) != nullptr) {
+        while ((chunk = context->get_chunk(chunk_id, &wait_stats)) != nullptr) {
+            if (chunk->encoded != nullptr) {
+                uint32_t count;
+                const MemCountersBusData *data = decoder.decode(chunk->encoded, count);
+                execute_chunk(chunk_id, data, count);
+                ++chunk_id;
+                continue;
+            }
             execute_chunk(chunk_id, chunk->data, chunk->count);
             ++chunk_id;
         }
@@ -92,6 +112,9 @@ public:
     uint32_t get_elapsed_ms() {
         return elapsed_ms;
     }
+    const MemWaitStats &get_wait_stats() const {
+        return wait_stats;
+    }
     void debug (void) {
         uint32_t index = 0;
         uint32_t last_segment_id = 0;
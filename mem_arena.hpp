@@ -0,0 +1,115 @@
+#ifndef __MEM_ARENA_HPP__
+#define __MEM_ARENA_HPP__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <cstddef>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <sstream>
+
+#include "mem_config.hpp"
+
+// Bump pointer arena of objects of a run, used by one thread. Blocks of MEM_ARENA_BLOCK_SIZE
+// (larger if a request needs it) are kept between runs and reset only rewinds to first block,
+// so after first run allocations don't call malloc. Objects aren't destroyed, they must not
+// need their destructor. An open allocation (tail) could grow until commit, its contents are
+// moved to next block if it doesn't fit; nothing else could be allocated while it's open.
+class MemArena {
+private:
+    struct Block {
+        uint8_t *data;
+        size_t size;
+    };
+    std::vector<Block> blocks;
+    uint32_t block;
+    size_t pos;
+    uint64_t bytes_served;                  // since reset
+    uint32_t mallocs;                       // blocks allocated since reset
+    static inline size_t align_up(size_t value, size_t align) {
+        return (value + align - 1) & ~(align - 1);
+    }
+    // next block with size bytes, blocks too small are skipped (until reset)
+    void next_block(size_t size) {
+        while (++block < blocks.size() && blocks[block].size < size);
+        if (block == blocks.size()) {
+            add_block(std::max(size, (size_t)MEM_ARENA_BLOCK_SIZE));
+        }
+        pos = 0;
+    }
+    void add_block(size_t size) {
+        uint8_t *data = (uint8_t *)malloc(size);
+        if (data == nullptr) {
+            std::ostringstream msg;
+            msg << "ERROR: MemArena out of memory (block of " << size << " bytes)";
+            throw std::runtime_error(msg.str());
+        }
+        blocks.push_back(Block{data, size});
+        ++mallocs;
+    }
+public:
+    MemArena() : block(0), pos(0), bytes_served(0) {
+        add_block(MEM_ARENA_BLOCK_SIZE);
+        mallocs = 0;
+    }
+    ~MemArena() {
+        for (auto &block: blocks) {
+            free(block.data);
+        }
+    }
+    // objects of previous run must not be used anymore
+    void reset() {
+        block = 0;
+        pos = 0;
+        bytes_served = 0;
+        mallocs = 0;
+    }
+    void *alloc(size_t size, size_t align = alignof(std::max_align_t)) {
+        size_t from = align_up(pos, align);
+        if (from + size > blocks[block].size) {
+            next_block(size);
+            from = 0;
+        }
+        pos = from + size;
+        bytes_served += size;
+        return blocks[block].data + from;
+    }
+    template <typename T, typename... Args>
+    T *create(Args&&... args) {
+        return new (alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+    // open allocation on free bytes of current block
+    void *tail(size_t &available, size_t align) {
+        pos = align_up(pos, align);
+        if (pos > blocks[block].size) {
+            next_block(0);
+        }
+        available = blocks[block].size - pos;
+        return blocks[block].data + pos;
+    }
+    // moves used bytes of open allocation to a block with size bytes free
+    void *grow(size_t used, size_t size, size_t &available) {
+        const uint8_t *from = blocks[block].data + pos;
+        next_block(size);
+        memcpy(blocks[block].data, from, used);
+        available = blocks[block].size;
+        return blocks[block].data;
+    }
+    // closes open allocation with its used bytes
+    void commit(size_t size) {
+        pos += size;
+        bytes_served += size;
+    }
+    uint64_t get_bytes_served() const {
+        return bytes_served;
+    }
+    uint32_t get_mallocs() const {
+        return mallocs;
+    }
+};
+
+#endif
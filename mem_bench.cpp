@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <random>
+#include <functional>
+
+#include "mem_types.hpp"
+#include "mem_config.hpp"
+#include "tools.hpp"
+#include "mem_counter.hpp"
+
+// Microbenchmarks of counting hot path, run with: make bench
+
+#define BENCH_RECORDS (1 << 22)
+#define BENCH_ROUNDS 4
+
+typedef uint32_t (*MemFilterFunction)(const MemCountersBusData *, uint32_t, const MemPartitionLayout &, uint32_t, MemDispatchEntry *);
+
+void generate_trace(std::vector<MemCountersBusData> &data, bool sequential) {
+    std::mt19937 rng(12345);
+    uint32_t seq_addr = 0xA0000000;
+    for (auto &record: data) {
+        uint32_t addr;
+        uint32_t bytes = 8;
+        if (sequential) {
+            seq_addr += 8;
+            addr = seq_addr;
+        } else {
+            addr = 0xA0000000 + (rng() % (1 << 24)) * 8;
+        }
+        switch (rng() % 10) {
+            case 0: bytes = 1; addr += rng() % 8; break;
+            case 1: bytes = 4; addr += rng() % 8; break;
+            case 2: bytes = 2; addr += (rng() % 4) * 2; break;
+        }
+        record.addr = addr;
+        record.flags = bytes | ((rng() % 3 == 0) << 16);
+    }
+}
+
+double bench_filter(const char *name, MemFilterFunction filter, const MemPartitionLayout &layout, const std::vector<MemCountersBusData> &data,
+                    std::vector<MemDispatchEntry> &out, uint32_t &total) {
+    uint64_t best = UINT64_MAX;
+    for (int round = 0; round < BENCH_ROUNDS; ++round) {
+        total = 0;
+        uint64_t init = get_usec();
+        for (uint32_t partition = 0; partition < layout.partitions; ++partition) {
+            for (uint32_t from = 0; from < data.size(); from += MEM_FILTER_BATCH) {
+                total += filter(data.data() + from, MEM_FILTER_BATCH, layout, partition, out.data() + total);
+            }
+        }
+        best = std::min(best, get_usec() - init);
+    }
+    double records_ns = ((double)data.size() * layout.partitions) / (best * 1000.0);
+    printf("filter %-8s %-8s %8.3f records/ns (%d entries)\n", name, layout.get_function_name(), records_ns, total);
+    return records_ns;
+}
+
+void bench_filters(uint32_t function) {
+    const MemPartitionLayout layout(MEM_PARTITIONS, function);
+    std::vector<MemCountersBusData> data(BENCH_RECORDS);
+    generate_trace(data, false);
+    std::vector<MemDispatchEntry> reference(BENCH_RECORDS * 2 + MEM_FILTER_SLACK);
+    std::vector<MemDispatchEntry> out(BENCH_RECORDS * 2 + MEM_FILTER_SLACK);
+    uint32_t reference_total, total;
+    bench_filter("scalar", mem_filter_scalar, layout, data, reference, reference_total);
+    #ifdef __AVX2__
+    bench_filter("avx2", mem_filter_avx2, layout, data, out, total);
+    if (total != reference_total || memcmp(out.data(), reference.data(), total * sizeof(MemDispatchEntry))) {
+        printf("ERROR: avx2 filter differs from scalar\n");
+    }
+    #endif
+    #ifdef __AVX512F__
+    bench_filter("avx512", mem_filter_avx512, layout, data, out, total);
+    if (total != reference_total || memcmp(out.data(), reference.data(), total * sizeof(MemDispatchEntry))) {
+        printf("ERROR: avx512 filter differs from scalar\n");
+    }
+    #endif
+}
+
+void bench_execute_chunk() {
+    std::vector<MemCountersBusData> data(BENCH_RECORDS);
+    generate_trace(data, false);
+    MemContext context;
+    MemCounter counter(0, &context);
+    // first chunk only to touch tables
+    counter.execute_chunk_scalar(0, data.data(), data.size());
+    uint64_t init = get_usec();
+    counter.execute_chunk_scalar(1, data.data(), data.size());
+    uint64_t scalar_us = get_usec() - init;
+    init = get_usec();
+    counter.execute_chunk(2, data.data(), data.size());
+    uint64_t vector_us = get_usec() - init;
+    printf("execute_chunk scalar %8.3f records/ns\n", data.size() / (scalar_us * 1000.0));
+    printf("execute_chunk filter %8.3f records/ns\n", data.size() / (vector_us * 1000.0));
+}
+
+// counting throughput by prefetch window, each window on a fresh counter (first chunk only
+// touches tables), best of BENCH_ROUNDS chunks.
+void bench_count_window(bool sequential) {
+    std::vector<MemCountersBusData> data(BENCH_RECORDS);
+    generate_trace(data, sequential);
+    MemContext context;
+    const uint32_t windows[] = {0, 4, 8, 16, 32, 64};
+    for (auto window: windows) {
+        MemCounter counter(0, &context);
+        counter.set_count_window(window);
+        counter.execute_chunk(0, data.data(), data.size());
+        uint64_t best = UINT64_MAX;
+        for (uint32_t chunk_id = 1; chunk_id <= BENCH_ROUNDS; ++chunk_id) {
+            uint64_t init = get_usec();
+            counter.execute_chunk(chunk_id, data.data(), data.size());
+            best = std::min(best, get_usec() - init);
+        }
+        printf("count %-10s window %2d %8.3f records/ns\n", sequential ? "sequential" : "random", window,
+               data.size() / (best * 1000.0));
+    }
+}
+
+int main(int argc, const char *argv[]) {
+    const char *name = argc > 1 ? argv[1] : "all";
+    if (!strcmp(name, "all") || !strcmp(name, "filter")) {
+        bench_filters(MEM_PARTITION_LANE);
+        bench_filters(MEM_PARTITION_XOR_FOLD);
+        bench_execute_chunk();
+    }
+    if (!strcmp(name, "all") || !strcmp(name, "count")) {
+        bench_count_window(false);
+        bench_count_window(true);
+    }
+    return 0;
+}
@@ -4,9 +4,7 @@
 #include "mem_config.hpp"
 class MemCheckPoint {
     public:
-        #ifndef MEM_CHECK_POINT_MAP
         uint32_t chunk_id;
-        #endif
         uint32_t from_addr;
         uint32_t from_skip;
         uint32_t to_addr;
@@ -14,11 +12,8 @@ class MemCheckPoint {
         uint32_t count;
         uint32_t from_count;
         uint32_t debug_row;
-        #ifdef MEM_CHECK_POINT_MAP
         MemCheckPoint(uint32_t chunk_id, uint32_t from_addr, uint32_t skip, uint32_t count, uint32_t debug_row = 0) :
-        #else
-        MemCheckPoint(uint32_t chunk_id, uint32_t from_addr, uint32_t skip, uint32_t count) : chunk_id(chunk_id),
-        #endif
+            chunk_id(chunk_id),
             from_addr(from_addr),
             from_skip(skip),
             to_addr(from_addr),
@@ -32,8 +27,6 @@ class MemCheckPoint {
             }
             #endif
         }
-        ~MemCheckPoint() {
-        }
         void add_rows(uint32_t addr, uint32_t count) {
             this->count += count;
             if (addr == from_addr) {
@@ -5,9 +5,16 @@
 #define MAX_MEM_PLANNERS 16
 #define USE_ADDR_COUNT_TABLE
 #define MAX_SEGMENTS 512
+// results of a plan by segment_id, slots by block and max blocks
+#define MEM_SEGMENTS_BLOCK 256
+#define MEM_SEGMENTS_MAX_BLOCKS 4096
+#define MEM_SEGMENTS_NO_COUNT 0xFFFFFFFF
 // #define MEM_PLANNER_STATS
 
-#define MEM_CHECK_POINT_MAP
+// bytes by block of run arenas (planner segments and checkpoints)
+#ifndef MEM_ARENA_BLOCK_SIZE
+#define MEM_ARENA_BLOCK_SIZE (1 << 21)
+#endif
 #define SEGMENT_STATS
 #define SEGMENT_LARGE_CHUNKS 512
 
@@ -18,27 +25,116 @@
 #define MEM_ALIGN_ROWS (1 << 22)
 #define MAX_CHUNKS 8192     // 2^13 * 2^18 = 2^31
 
-#define THREAD_BITS 3
-#define ADDR_LOW_BITS (THREAD_BITS + 3)
-#define MAX_THREADS (1 << THREAD_BITS)
-#define ADDR_MASK ((MAX_THREADS - 1) * 8)
+// partitions (counters) are chosen at runtime, power of 2 between limits
+#define MIN_PARTITION_BITS 2
+#define MAX_PARTITION_BITS 5
+#define MAX_PARTITIONS (1 << MAX_PARTITION_BITS)
+#ifndef MEM_PARTITIONS
+#define MEM_PARTITIONS 8
+#endif
+
+// partition function, lane (address bits 3..) or lane xor fold of upper address bits
+#define MEM_PARTITION_LANE 0
+#define MEM_PARTITION_XOR_FOLD 1
+#ifndef MEM_PARTITION_FUNCTION
+#define MEM_PARTITION_FUNCTION MEM_PARTITION_LANE
+#endif
+
+// threads that run counters, 0 = one thread by partition
+#ifndef MEM_COUNT_THREADS
+#define MEM_COUNT_THREADS 0
+#endif
 
 #define MAX_PAGES 20
-#define ADDR_PAGE_BITS (23 - THREAD_BITS)
-#define ADDR_PAGE_SIZE (1 << ADDR_PAGE_BITS)
-#define RELATIVE_OFFSET_MASK (ADDR_PAGE_SIZE - 1)
-#define ADDR_TABLE_SIZE (ADDR_PAGE_SIZE * MAX_PAGES)
-#define OFFSET_BITS (25 + 4 - THREAD_BITS) // 4 bits (3 bits for 6 pages, 1 bit security)
-#define OFFSET_PAGE_SHIFT_BITS (OFFSET_BITS - 3)
+
+// counters keep rows by blocks of offsets, used to locate segment boundaries
+#define MEM_ROW_BLOCK_BITS 12
+#define MEM_ROW_BLOCK_SIZE (1 << MEM_ROW_BLOCK_BITS)
+
+// threads that generate locators of a planner, each one on a subrange of row blocks (1 = serial)
+#ifndef MEM_LOCATOR_THREADS
+#define MEM_LOCATOR_THREADS 4
+#endif
+#define MEM_LOCATOR_MIN_BLOCKS 1024
+
+// threads that build address index after count phase, each one on a subrange of row blocks
+#ifndef MEM_INDEX_THREADS
+#define MEM_INDEX_THREADS 4
+#endif
+#define MEM_INDEX_MIN_BLOCKS 256
+
+// threads of each immutable planner (rom, input), each one plans a range of segments
+#ifndef MEM_IMMUTABLE_PLAN_THREADS
+#define MEM_IMMUTABLE_PLAN_THREADS 4
+#endif
 
 #define ADDR_SLOT_BITS 4
 #define ADDR_SLOT_SIZE (1 << ADDR_SLOT_BITS)
 #define ADDR_SLOT_MASK (0xFFFFFFFF << ADDR_SLOT_BITS)
-#define ADDR_SLOTS ((1024 * 1024 * 32) / MAX_THREADS)
+#define ADDR_TOTAL_SLOTS (1024 * 1024 * 32)
+
+// slot entry: escape(1) | count(18) | chunk_id(13), escaped entries have an index of
+// counter overflow table instead of count
+#define SLOT_ENTRY_CHUNK_BITS 13
+#define SLOT_ENTRY_CHUNK_MASK ((1 << SLOT_ENTRY_CHUNK_BITS) - 1)
+#define SLOT_ENTRY_COUNT_BITS 18
+#define SLOT_ENTRY_MAX_COUNT ((1 << SLOT_ENTRY_COUNT_BITS) - 1)
+#define SLOT_ENTRY_ESCAPE 0x80000000
+
+// slot blocks taken by a counter from shared arena each time
+#define MEM_SLOT_MAGAZINE_BLOCKS 4096
+#define MEM_SLOT_NO_MAGAZINE 0xFFFFFFFF
 
-#define ADDR_SLOTS_SIZE (ADDR_SLOT_SIZE * ADDR_SLOTS)
 #define TIME_US_BY_CHUNK 350
 
+// workers of task pool (count and plan phases), 0 = hardware threads. Pool grows to run all
+// tasks that block at same time (counters, dispatchers, mem align)
+#ifndef MEM_TASK_POOL_THREADS
+#define MEM_TASK_POOL_THREADS 0
+#endif
+#define MEM_TASK_POOL_MAX_WORKERS 256
+
+// pause iterations that a chunk consumer spins before park waiting next chunk
+#ifndef MEM_WAIT_SPIN_BUDGET
+#define MEM_WAIT_SPIN_BUDGET 2048
+#endif
+
+// records filtered by MemCounter in each vectorized batch
+#define MEM_FILTER_BATCH 1024
+
+// count engines: by partition (each counter reads whole trace) or by chunk ranges (workers
+// count ranges of chunks for all partitions, later merged by partition)
+#define MEM_COUNT_BY_PARTITION 0
+#define MEM_COUNT_BY_CHUNK_RANGE 1
+#ifndef MEM_COUNT_ENGINE
+#define MEM_COUNT_ENGINE MEM_COUNT_BY_PARTITION
+#endif
+
+// chunks by range and workers of chunk range engine (0 = hardware threads)
+#define MEM_COUNT_RANGE_CHUNKS 16
+#ifndef MEM_COUNT_RANGE_THREADS
+#define MEM_COUNT_RANGE_THREADS 0
+#endif
+// aggregation table of a range worker, twice the entries of a chunk
+#define MEM_RANGE_HASH_BITS 20
+#define MEM_RANGE_HASH_SIZE (1 << MEM_RANGE_HASH_BITS)
+#define MEM_RANGE_RADIX_BITS 13
+
+// records whose address table entries are prefetched ahead of counting, 0 = no prefetch
+#ifndef MEM_COUNT_WINDOW
+#define MEM_COUNT_WINDOW 16
+#endif
+
+// threads that split chunks by counter before counting, 0 = each counter reads whole chunks
+#ifndef MEM_DISPATCH_THREADS
+#define MEM_DISPATCH_THREADS 0
+#endif
+
+// MemTest prints counter metrics (JSON) each this chunks added, 0 = never
+#ifndef MEM_METRICS_SAMPLE_CHUNKS
+#define MEM_METRICS_SAMPLE_CHUNKS 1024
+#endif
+
 #define NO_CHUNK_ID 0xFFFFFFFF
 #define EMPTY_PAGE 0xFFFFFFFF
 
@@ -23,6 +23,7 @@
 #include "mem_types.hpp"
 #include "mem_config.hpp"
 #include "mem_locators.hpp"
+#include "mem_signal.hpp"
 
 class MemContext {
 public:
@@ -30,19 +31,30 @@ public:
     MemLocators locators;
     std::atomic<uint32_t> chunks_count;
     std::atomic<bool> chunks_completed;
+    MemSignal chunk_signal;
     void clear () {
         chunks_count.store(0, std::memory_order_release);
         chunks_completed.store(false, std::memory_order_release);
     }
-    const MemChunk *get_chunk(uint32_t chunk_id) {
-        while (chunk_id >= chunks_count.load(std::memory_order_acquire)) {
-            if (chunks_completed.load(std::memory_order_acquire)) {
+    void reset() {
+        clear();
+        locators.reset();
+    }
+    const MemChunk *get_chunk(uint32_t chunk_id, MemWaitStats *wait_stats = nullptr) {
+        if (chunk_id >= chunks_count.load(std::memory_order_acquire)) {
+            chunk_signal.wait([this, chunk_id]() {
+                return chunk_id < chunks_count.load(std::memory_order_acquire) ||
+                       chunks_completed.load(std::memory_order_acquire);
+            }, wait_stats);
+            if (chunk_id >= chunks_count.load(std::memory_order_acquire)) {
                 return nullptr;
             }
-            usleep(1);
         }
         return &chunks[chunk_id];
     }
+    void set_spin_budget(uint32_t spin_budget) {
+        chunk_signal.set_spin_budget(spin_budget);
+    }
 
     MemContext() : chunks_count(0), chunks_completed(false) {
     }
@@ -50,10 +62,21 @@ public:
         uint32_t chunk_id = chunks_count.load(std::memory_order_relaxed);
         chunks[chunk_id].data = data;
         chunks[chunk_id].count = count;
+        chunks[chunk_id].encoded = nullptr;
+        chunks_count.store(chunk_id + 1, std::memory_order_release);
+        chunk_signal.notify();
+    }
+    void add_encoded_chunk(const uint8_t *encoded, uint32_t count) {
+        uint32_t chunk_id = chunks_count.load(std::memory_order_relaxed);
+        chunks[chunk_id].data = nullptr;
+        chunks[chunk_id].count = count;
+        chunks[chunk_id].encoded = encoded;
         chunks_count.store(chunk_id + 1, std::memory_order_release);
+        chunk_signal.notify();
     }
     void set_completed() {
         chunks_completed.store(true, std::memory_order_release);
+        chunk_signal.notify_always();
     }
     uint32_t size() {
         return chunks_count.load(std::memory_order_acquire);
@@ -17,6 +17,8 @@
 #include <map>
 #include <unordered_map>
 #include <stdexcept>
+#include <sstream>
+#include <string>
 #include <mutex>
 #include <atomic>
 
@@ -30,6 +32,12 @@
 #include "mem_context.hpp"
 #include "immutable_mem_planner.hpp"
 #include "mem_segments.hpp"
+#include "mem_dispatcher.hpp"
+#include "mem_partition.hpp"
+#include "mem_slot_arena.hpp"
+#include "mem_range_counter.hpp"
+#include "mem_addr_index.hpp"
+#include "mem_task_pool.hpp"
 
 typedef struct {
     int thread_index;
@@ -41,24 +49,82 @@ typedef struct {
 class MemCountAndPlan {
 private:
     uint32_t max_chunks;
-    std::vector<std::thread> plan_threads;
+    MemTaskPool *pool;
+    MemTask *executed;                          // last task of current execution, nullptr if none
+    MemSegments *ram_segments;
+    MemSegments *rom_segments;
+    MemSegments *input_segments;
     std::vector<MemCounter *> count_workers;
     MemAlignCounter *mem_align_counter;
     MemContext *context;
+    const MemPartitionLayout layout;
+    MemSlotArena *slot_arena;
+    uint32_t count_threads;
+    MemDispatcher *dispatcher;
+    uint32_t dispatch_threads;
+    uint32_t count_window;
+    uint32_t count_engine;
+    uint32_t range_threads;
+    MemRangeCounter *range_counter;
+    MemAddrIndex *addr_index;
     MemPlanner *quick_mem_planner;
     ImmutableMemPlanner *rom_data_planner;
     ImmutableMemPlanner *input_data_planner;
-    std::vector<MemPlanner> plan_workers;
-    std::thread *parallel_execute;
+    std::vector<MemPlanner *> plan_workers;
+    bool prepared;
     uint64_t t_init_us;
     uint64_t t_count_us;
     uint64_t t_prepare_us;
+    uint64_t t_plan_init_us;
     uint64_t t_plan_us;
 public:
-    MemCountAndPlan() {
+    // partitions: number of counters (power of 2, 4..32), count_threads: threads that run
+    // them (0 = one by partition), partition_function: MEM_PARTITION_LANE or MEM_PARTITION_XOR_FOLD
+    MemCountAndPlan(uint32_t partitions = MEM_PARTITIONS, uint32_t count_threads = MEM_COUNT_THREADS,
+                    uint32_t partition_function = MEM_PARTITION_FUNCTION)
+    : mem_align_counter(nullptr), layout(partitions, partition_function), count_threads(count_threads), dispatch_threads(MEM_DISPATCH_THREADS),
+      count_window(MEM_COUNT_WINDOW), count_engine(MEM_COUNT_ENGINE), range_threads(MEM_COUNT_RANGE_THREADS), quick_mem_planner(nullptr), rom_data_planner(nullptr), input_data_planner(nullptr),
+      prepared(false), t_prepare_us(0) {
+        if (this->count_threads == 0 || this->count_threads > partitions) {
+            this->count_threads = partitions;
+        }
         context = new MemContext();
+        dispatcher = new MemDispatcher(context, layout);
+        range_counter = new MemRangeCounter(context, layout);
+        addr_index = new MemAddrIndex(layout);
+        if (range_threads == 0) {
+            range_threads = std::max(1U, std::thread::hardware_concurrency());
+        }
+        slot_arena = new MemSlotArena();
+        pool = new MemTaskPool(MEM_TASK_POOL_THREADS);
+        executed = nullptr;
+        ram_segments = nullptr;
+        rom_segments = nullptr;
+        input_segments = nullptr;
     }
     ~MemCountAndPlan() {
+        if (executed != nullptr) {
+            wait();
+        }
+        delete pool;
+        delete ram_segments;
+        delete rom_segments;
+        delete input_segments;
+        for (auto counter: count_workers) {
+            delete counter;
+        }
+        for (auto planner: plan_workers) {
+            delete planner;
+        }
+        delete mem_align_counter;
+        delete quick_mem_planner;
+        delete rom_data_planner;
+        delete input_data_planner;
+        delete dispatcher;
+        delete range_counter;
+        delete addr_index;
+        delete slot_arena;
+        delete context;
     }
     void clear() {
         // for (auto& chunk : chunks) {
@@ -67,13 +133,18 @@ public:
         context->clear();
     }
     void prepare() {
-        uint init = get_usec();
+        if (prepared) {
+            reset();
+            return;
+        }
+        uint64_t init = get_usec();
         printf("Preparing MemCountAndPlan (clear count_workers)...\n");
         count_workers.clear();
         printf("Preparing MemCountAndPlan (count_workers)...\n");
-        for (size_t i = 0; i < MAX_THREADS; ++i) {
+        for (size_t i = 0; i < layout.partitions; ++i) {
             printf("Preparing MemCountAndPlan (count_worker %ld)...\n", i);
-            count_workers.push_back(new MemCounter(i, context));
+            count_workers.push_back(new MemCounter(i, context, layout, slot_arena));
+            count_workers.back()->set_count_window(count_window);
         }
         printf("Preparing MemCountAndPlan (mem_align_counter)...\n");
         mem_align_counter = new MemAlignCounter(MEM_ALIGN_ROWS, context);
@@ -86,88 +157,199 @@ public:
         quick_mem_planner = new MemPlanner(0, RAM_ROWS, 0xA0000000, 512);
         printf("Preparing MemCountAndPlan (planners)...\n");
         for (int i = 0; i < MAX_MEM_PLANNERS; ++i) {
-            plan_workers.emplace_back(i+1, RAM_ROWS, 0xA0000000, 512);
+            plan_workers.push_back(new MemPlanner(i+1, RAM_ROWS, 0xA0000000, 512));
         }
+        ram_segments = new MemSegments();
+        rom_segments = new MemSegments();
+        input_segments = new MemSegments();
+        // one segment by locator at most, slots are ready before planners publish
+        ram_segments->reserve(MAX_LOCATORS);
         printf("Prepared MemCountAndPlan\n");
+        prepared = true;
+        t_prepare_us = get_usec() - init;
+    }
+    // returns all components to a clean state for next trace, without re-allocation.
+    // Previous execution must be finished (wait).
+    void reset() {
+        uint64_t init = get_usec();
+        if (executed != nullptr) {
+            wait();
+        }
+        context->reset();
+        dispatcher->reset();
+        range_counter->reset();
+        for (auto counter: count_workers) {
+            counter->reset();
+        }
+        mem_align_counter->reset();
+        quick_mem_planner->reset();
+        rom_data_planner->reset();
+        input_data_planner->reset();
+        for (auto planner: plan_workers) {
+            planner->reset();
+        }
+        ram_segments->reset();
+        rom_segments->reset();
+        input_segments->reset();
+        pool->reset_stats();
+        t_count_us = 0;
+        t_plan_us = 0;
         t_prepare_us = get_usec() - init;
     }
     void add_chunk(MemCountersBusData *chunk_data, uint32_t chunk_size) {
         context->add_chunk(chunk_data, chunk_size);
     }
-    void detach_execute() {
-        // printf("MemCountAndPlan::count_phase\n");
-        count_phase();
-        // printf("MemCountAndPlan::plan_phase\n");
-        plan_phase();
+    void add_encoded_chunk(const uint8_t *encoded_chunk, uint32_t chunk_size) {
+        context->add_encoded_chunk(encoded_chunk, chunk_size);
     }
+    // submits count and plan tasks to pool, wait returns when they are finished
     void execute(void) {
-        parallel_execute = new std::thread([this](){ this->detach_execute();});
-        // parallel_execute.detach();
+        t_init_us = get_usec();
+        MemTask *counted = count_phase();
+        MemTask *aligned = pool->submit([this](){ mem_align_counter->execute();});
+        executed = plan_phase(counted, aligned);
     }
-    void count_phase() {
-        uint64_t init = t_init_us = get_usec();
-        std::vector<std::thread> threads;
-
-        for (int i = 0; i < MAX_THREADS; ++i) {
-            threads.emplace_back([this, i](){count_workers[i]->execute();});
-        }
-        threads.emplace_back([this](){ mem_align_counter->execute();});
-
-        for (auto& t : threads) {
-            t.join();
+    // counters of partitions (or ranges and merges), returns task finished when all are counted.
+    // Counters wait chunks, pool has a worker for each one (and dispatchers, mem align).
+    MemTask *count_phase() {
+        std::vector<MemTask *> tasks;
+        if (count_engine == MEM_COUNT_BY_CHUNK_RANGE) {
+            pool->reserve(range_threads + 1);
+            range_counter->reserve_workers(range_threads);
+            for (uint32_t i = 0; i < range_threads; ++i) {
+                tasks.push_back(pool->submit([this, i](){ range_counter->execute(i);}));
+            }
+            // partitions are merged in parallel after all ranges are counted
+            const uint32_t merge_threads = std::min(range_threads, layout.partitions);
+            std::vector<MemTask *> ranges;
+            ranges.swap(tasks);
+            for (uint32_t i = 0; i < merge_threads; ++i) {
+                tasks.push_back(pool->submit([this, i, merge_threads](){
+                    for (uint32_t partition = i; partition < layout.partitions; partition += merge_threads) {
+                        range_counter->merge(count_workers[partition]);
+                    }
+                }, ranges));
+            }
+        } else {
+            pool->reserve(dispatch_threads + count_threads + 1);
+            for (uint32_t i = 0; i < dispatch_threads; ++i) {
+                tasks.push_back(pool->submit([this](){ dispatcher->execute();}));
+            }
+            if (count_threads == layout.partitions) {
+                for (uint32_t i = 0; i < layout.partitions; ++i) {
+                    if (dispatch_threads > 0) {
+                        tasks.push_back(pool->submit([this, i](){count_workers[i]->execute_dispatched(dispatcher);}));
+                    } else {
+                        tasks.push_back(pool->submit([this, i](){count_workers[i]->execute();}));
+                    }
+                }
+            } else {
+                // partitions distributed round robin between count tasks
+                std::vector<std::vector<MemCounter *>> groups(count_threads);
+                for (uint32_t i = 0; i < layout.partitions; ++i) {
+                    groups[i % count_threads].push_back(count_workers[i]);
+                }
+                for (uint32_t i = 0; i < count_threads; ++i) {
+                    MemDispatcher *group_dispatcher = dispatch_threads > 0 ? dispatcher : nullptr;
+                    tasks.push_back(pool->submit([group = groups[i], group_dispatcher](){ MemCounter::execute_group(group, group_dispatcher);}));
+                }
+            }
         }
-        t_count_us = (uint32_t) (get_usec() - init);
+        return pool->submit([this](){ t_count_us = (uint32_t) (get_usec() - t_init_us);}, tasks);
     }
-
-    void plan_phase() {
-        uint64_t init = get_usec();
-        std::vector<std::thread> threads;
-
-        plan_threads.emplace_back([this](){ quick_mem_planner->generate_locators(count_workers, context->locators);});
-        plan_threads.emplace_back([this](){ rom_data_planner->execute(count_workers);});
-        plan_threads.emplace_back([this](){ input_data_planner->execute(count_workers);});
-        MemSegments ram_segments;
+    // address index after counters, locators, immutable planners and ram planners after index
+    // (ram planners take locators while they are generated). Ram planners block waiting for
+    // locators, pool has a worker for each one and for locators, rom and input planners and mem
+    // align (it could be running yet).
+    // Returns task that prints segments when all planners and mem align finished.
+    MemTask *plan_phase(MemTask *counted, MemTask *aligned) {
+        pool->reserve(MAX_MEM_PLANNERS + 4);
+        MemTask *indexed = pool->submit([this](){
+            t_plan_init_us = get_usec();
+            addr_index->build(count_workers);
+        }, {counted});
+        MemTask *located = pool->submit([this](){
+            quick_mem_planner->generate_locators(*addr_index, context->locators);
+            ram_segments->set_count(context->locators.size());
+        }, {indexed});
+        std::vector<MemTask *> planned;
+        planned.push_back(located);
+        planned.push_back(pool->submit([this](){ rom_data_planner->execute(*addr_index);}, {indexed}));
+        planned.push_back(pool->submit([this](){ input_data_planner->execute(*addr_index);}, {indexed}));
         for (int i = 0; i < MAX_MEM_PLANNERS; ++i) {
-            threads.emplace_back([this, i, &ram_segments](){ plan_workers[i].execute_from_locators(count_workers, context->locators, ram_segments);});
-        }
-        for (auto& t : threads) {
-            t.join();
-        }
-        for (auto& t : plan_threads) {
-            t.join();
+            planned.push_back(pool->submit([this, i](){ plan_workers[i]->execute_from_locators(*addr_index, context->locators, *ram_segments);}, {indexed}));
         }
-        t_plan_us = (uint32_t) (get_usec() - init);
-
-        MemSegments rom_segments;
-        rom_data_planner->collect_segments(rom_segments);
-
-        MemSegments input_segments;
-        input_data_planner->collect_segments(input_segments);
-        ram_segments.debug();
-        rom_segments.debug();
-        input_segments.debug();
-        mem_align_counter->debug();
+        planned.push_back(aligned);
+        return pool->submit([this](){
+            t_plan_us = (uint32_t) (get_usec() - t_plan_init_us);
+            rom_data_planner->collect_segments(*rom_segments);
+            input_data_planner->collect_segments(*input_segments);
+            ram_segments->debug();
+            rom_segments->debug();
+            input_segments->debug();
+            mem_align_counter->debug();
+        }, planned);
     }
     void stats() {
         printf("==== STATS ====\n");
         uint32_t tot_used_slots = 0;
-        for (size_t i = 0; i < MAX_THREADS; ++i) {
+        uint64_t tot_records = 0;
+        uint64_t max_records = 0;
+        for (size_t i = 0; i < layout.partitions; ++i) {
             uint32_t used_slots = count_workers[i]->get_used_slots();
             tot_used_slots += used_slots;
-            printf("Thread %ld: used slots %d/%d (%04.02f%%) T:%d ms S:%d ms Q:%d\n",
-                i, used_slots, ADDR_SLOTS,
-                ((double)used_slots*100.0)/(double)(ADDR_SLOTS), count_workers[i]->get_elapsed_ms(),
-                count_workers[i]->get_tot_usleep()/1000,
-                count_workers[i]->get_queue_full_times()/1000);
-        }
-        printf("\n> threads: %d\n", MAX_THREADS);
-        printf("> address table: %ld MB\n", (ADDR_TABLE_SIZE * ADDR_TABLE_ELEMENT_SIZE * MAX_THREADS)>>20);
-        printf("> memory slots: %ld MB (used: %ld MB)\n", (ADDR_SLOTS_SIZE * sizeof(uint32_t) * MAX_THREADS)>>20, (tot_used_slots * ADDR_SLOT_SIZE * sizeof(uint32_t))>> 20);
-        printf("> page table: %ld MB\n\n", (ADDR_PAGE_SIZE * sizeof(uint32_t))>> 20);
+            uint64_t records = count_workers[i]->get_matched();
+            tot_records += records;
+            max_records = std::max(max_records, records);
+            const MemWaitStats &wait_stats = count_workers[i]->get_wait_stats();
+            printf("Thread %ld: records %ld used slots %d (%d magazines) T:%d ms S:%ld ms P:%ld ms (%d parks)\n",
+                i, records, used_slots, count_workers[i]->get_magazines(), count_workers[i]->get_elapsed_ms(),
+                wait_stats.spin_us/1000, wait_stats.parked_us/1000, wait_stats.parks);
+            uint32_t first_unmapped_addr;
+            uint32_t unmapped = count_workers[i]->get_unmapped_count(first_unmapped_addr);
+            if (unmapped > 0) {
+                printf("Thread %ld: WARNING %d accesses out of regions (first 0x%08X)\n", i, unmapped, first_unmapped_addr);
+            }
+        }
+        const MemWaitStats &align_wait_stats = mem_align_counter->get_wait_stats();
+        printf("MemAlign: T:%d ms S:%ld ms P:%ld ms (%d parks)\n", mem_align_counter->get_elapsed_ms(),
+            align_wait_stats.spin_us/1000, align_wait_stats.parked_us/1000, align_wait_stats.parks);
+        if (count_engine == MEM_COUNT_BY_CHUNK_RANGE) {
+            printf("Ranges: %d threads %d ranges T:%d ms merge:%d ms\n", range_threads, range_counter->get_used_ranges(),
+                range_counter->get_elapsed_ms(), range_counter->get_merge_ms());
+        } else if (dispatch_threads > 0) {
+            printf("Dispatch: %d threads T:%d ms\n", dispatch_threads, dispatcher->get_elapsed_ms());
+        }
+        printf("\n> partitions: %d (%s)\n", layout.partitions, layout.get_function_name());
+        printf("> partition records: %ld (max %ld, imbalance %04.2f)\n", tot_records, max_records,
+            tot_records ? (double)max_records * layout.partitions / tot_records : 0.0);
+        printf("> threads: %d\n", count_threads);
+        printf("> count engine: %s\n", count_engine == MEM_COUNT_BY_CHUNK_RANGE ? "chunk ranges" : "partitions");
+        printf("> count window: %d\n", count_window);
+        printf("> addr index: %d entries, %04.2f ms\n", addr_index->size(), addr_index->get_elapsed_us() / 1000.0);
+        uint64_t arena_bytes = 0;
+        uint32_t arena_mallocs = 0;
+        rom_data_planner->add_arena_stats(arena_bytes, arena_mallocs);
+        input_data_planner->add_arena_stats(arena_bytes, arena_mallocs);
+        for (auto planner: plan_workers) {
+            planner->add_arena_stats(arena_bytes, arena_mallocs);
+        }
+        printf("> plan arenas: %ld KB served, %d block mallocs\n", arena_bytes >> 10, arena_mallocs);
+        printf("> task pool: %d workers, %ld tasks, %ld steals\n", pool->size(), pool->get_executed(), pool->get_steals());
+        printf("> address table: %ld MB\n", (layout.table_size * ADDR_TABLE_ELEMENT_SIZE * layout.partitions)>>20);
+        uint64_t magazine_bytes = MEM_SLOT_MAGAZINE_BLOCKS * ADDR_SLOT_SIZE * sizeof(uint32_t);
+        printf("> memory slots: %ld MB (used: %ld MB, %d/%d magazines %ld MB, %04.02f%%)\n",
+            ((uint64_t)slot_arena->get_size() * sizeof(uint32_t))>>20, ((uint64_t)tot_used_slots * ADDR_SLOT_SIZE * sizeof(uint32_t))>> 20,
+            slot_arena->get_magazines_in_use(), slot_arena->get_magazines(), (slot_arena->get_magazines_in_use() * magazine_bytes) >> 20,
+            ((double)tot_used_slots*100.0)/(double)slot_arena->get_blocks());
+        printf("> page table: %ld MB\n\n", (layout.page_size * sizeof(uint32_t))>> 20);
         quick_mem_planner->stats();
+        rom_data_planner->stats();
+        input_data_planner->stats();
         for (uint32_t i = 0; i < plan_workers.size(); ++i) {
-            plan_workers[i].stats();
+            plan_workers[i]->stats();
         }
+        printf("prepare: %04.2f ms\n", t_prepare_us / 1000.0);
         printf("execution: %04.2f ms\n", (TIME_US_BY_CHUNK * context->size()) / 1000.0);
         printf("count_phase: %04.2f ms\n", t_count_us / 1000.0);
         printf("plan_phase: %04.2f ms\n", t_plan_us / 1000.0);
@@ -175,22 +357,76 @@ public:
     void set_completed() {
         context->set_completed();
     }
+    void set_spin_budget(uint32_t spin_budget) {
+        context->set_spin_budget(spin_budget);
+        dispatcher->set_spin_budget(spin_budget);
+    }
+    // 0 disables dispatch stage, must be called before execute
+    void set_dispatch_threads(uint32_t threads) {
+        dispatch_threads = threads;
+    }
+    // MEM_COUNT_BY_PARTITION or MEM_COUNT_BY_CHUNK_RANGE (threads: range workers, 0 = hardware
+    // threads), must be called before execute
+    void set_count_engine(uint32_t engine, uint32_t threads = 0) {
+        if (engine != MEM_COUNT_BY_PARTITION && engine != MEM_COUNT_BY_CHUNK_RANGE) {
+            std::ostringstream msg;
+            msg << "ERROR: MemCountAndPlan invalid count engine " << engine;
+            throw std::runtime_error(msg.str());
+        }
+        count_engine = engine;
+        range_threads = threads ? threads : std::max(1U, std::thread::hardware_concurrency());
+    }
+    // live metrics of counters as JSON, could be called from any thread while executing. With
+    // chunk ranges progress is on range workers, counters are null until they are merged.
+    std::string get_metrics_json() {
+        std::ostringstream out;
+        const uint32_t available_chunks = context->size();
+        out << "{\"chunks\":" << available_chunks << ",\"completed\":" << (context->chunks_completed.load() ? "true" : "false");
+        if (count_engine == MEM_COUNT_BY_CHUNK_RANGE) {
+            out << ",\"range_workers\":[";
+            range_counter->metrics_to_json(out, available_chunks);
+            out << "]";
+            if (!range_counter->is_merged()) {
+                out << ",\"counters\":null}";
+                return out.str();
+            }
+        }
+        out << ",\"counters\":[";
+        for (uint32_t i = 0; i < count_workers.size(); ++i) {
+            if (i > 0) out << ",";
+            count_workers[i]->get_metrics().to_json(out, i, available_chunks);
+        }
+        out << "]}";
+        return out.str();
+    }
+    // prefetch window of counters (records), 0 disables prefetch
+    void set_count_window(uint32_t window) {
+        count_window = window;
+        for (auto counter: count_workers) {
+            counter->set_count_window(window);
+        }
+    }
     void wait() {
-        parallel_execute->join();
-        delete parallel_execute;
-        parallel_execute = nullptr;
+        pool->wait(executed);
+        executed = nullptr;
+        pool->release();
     }
 
 };
 
-MemCountAndPlan *create_mem_count_and_plan(void) {
-    MemCountAndPlan *mcp = new MemCountAndPlan();
+MemCountAndPlan *create_mem_count_and_plan(uint32_t partitions = MEM_PARTITIONS, uint32_t count_threads = MEM_COUNT_THREADS,
+                                           uint32_t partition_function = MEM_PARTITION_FUNCTION) {
+    MemCountAndPlan *mcp = new MemCountAndPlan(partitions, count_threads, partition_function);
     printf("MemCountAndPlan created. Preparing ....\n");
     mcp->prepare();
     printf("MemCountAndPlan prepared\n");
     return mcp;
 }
 
+void reset_mem_count_and_plan(MemCountAndPlan *mcp) {
+    mcp->reset();
+}
+
 void destroy_mem_count_and_plan(MemCountAndPlan *mcp) {
     if (mcp) {
         mcp->clear();
@@ -206,11 +442,19 @@ void add_chunk_mem_count_and_plan(MemCountAndPlan *mcp, MemCountersBusData *chun
     mcp->add_chunk(chunk_data, chunk_size);
 }
 
+void add_encoded_chunk_mem_count_and_plan(MemCountAndPlan *mcp, const uint8_t *encoded_chunk, uint32_t chunk_size) {
+    mcp->add_encoded_chunk(encoded_chunk, chunk_size);
+}
+
 void stats_mem_count_and_plan(MemCountAndPlan *mcp) {
     mcp->stats();
 }
 
 
+std::string metrics_mem_count_and_plan(MemCountAndPlan *mcp) {
+    return mcp->get_metrics_json();
+}
+
 void set_completed_mem_count_and_plan(MemCountAndPlan *mcp) {
     mcp->set_completed();
 }
@@ -20,6 +20,13 @@
 #include "mem_config.hpp"
 #include "mem_types.hpp"
 #include "mem_context.hpp"
+#include "mem_partition.hpp"
+#include "mem_region_map.hpp"
+#include "mem_slot_arena.hpp"
+#include "mem_trace_codec.hpp"
+#include "mem_dispatcher.hpp"
+#include "mem_counter_filter.hpp"
+#include "mem_counter_metrics.hpp"
 #include "tools.hpp"
 
 #ifdef USE_ADDR_COUNT_TABLE
@@ -31,10 +38,16 @@ struct AddrCount {
 #else
 #define ADDR_TABLE_ELEMENT_SIZE sizeof(uint32_t)
 #endif
+// Slots: blocks of ADDR_SLOT_SIZE words [prev block, next block, 14 entries], blocks of an
+// address are chained (next of last block points to first). Entries are packed words
+// chunk_id | count << 13, counts over 18 bits go to an overflow table (SLOT_ENTRY_ESCAPE).
 class MemCounter {
+    static_assert(MAX_CHUNKS <= (1 << SLOT_ENTRY_CHUNK_BITS), "chunk_id doesn't fit on slot entry");
 private:
     const uint32_t id;
     MemContext *context;
+    const MemPartitionLayout layout;
+    const MemRegionMap region_map;
     int count;
     int addr_count;
 
@@ -43,95 +56,335 @@ private:
     #else
     uint32_t *addr_table;
     #endif
+    MemSlotArena *arena;
+    bool own_arena;
+    std::vector<uint32_t> magazines;
+    std::vector<uint32_t> overflow_counts;     // counts of escaped slot entries
     uint32_t *addr_slots;
     uint32_t current_chunk;
-    uint32_t free_slot;
+    uint32_t slot_pos;
+    uint32_t slot_end;
+    uint32_t used_slots;
     uint32_t elapsed_ms;
-    uint32_t tot_usleep;
-    uint32_t queue_full;
-    const uint32_t addr_mask;
+    MemWaitStats wait_stats;
+    MemTraceDecoder decoder;
+    MemDispatchEntry filter_buffer[2 * MEM_FILTER_BATCH + MEM_FILTER_SLACK];
+    uint32_t window_offsets[MEM_FILTER_BATCH];
+    uint32_t count_window;
+    uint32_t unmapped_count;
+    uint32_t first_unmapped_addr;
+    uint64_t records;
+    uint64_t matched;
+    uint64_t chain_extensions;
+    MemCounterMetrics metrics;
+    uint64_t *block_rows;                       // rows by MEM_ROW_BLOCK_SIZE offsets
+    uint32_t row_blocks;
+    uint64_t *occupancy;                        // one bit by offset with address table entry
+    uint32_t occupancy_words;
+    static const uint32_t NO_OFFSET = 0xFFFFFFFF;
 public:
     uint32_t first_offset[MAX_PAGES];
     uint32_t last_offset[MAX_PAGES];
-    MemCounter(uint32_t id, MemContext *context)
-    :id(id), context(context), addr_mask(id * 8) {
+    // without arena, counter uses a private one sized for its partition
+    MemCounter(uint32_t id, MemContext *context, const MemPartitionLayout &layout = MemPartitionLayout(), MemSlotArena *arena = nullptr)
+    :id(id), context(context), layout(layout), region_map(layout), arena(arena) {
         count = 0;
-        queue_full = 0;
-        tot_usleep = 0;
+        records = 0;
+        matched = 0;
+        chain_extensions = 0;
+        unmapped_count = 0;
+        first_unmapped_addr = 0;
+        count_window = std::min((uint32_t)MEM_COUNT_WINDOW, (uint32_t)MEM_FILTER_BATCH);
         #ifdef USE_ADDR_COUNT_TABLE
-        addr_count_table = (AddrCount *)malloc(ADDR_TABLE_SIZE * sizeof(AddrCount));
-        memset(addr_count_table, 0, ADDR_TABLE_SIZE * sizeof(AddrCount));
+        addr_count_table = (AddrCount *)lazy_alloc(layout.table_size * sizeof(AddrCount));
         #else
-        addr_table = (uint32_t *)malloc(ADDR_TABLE_SIZE * sizeof(uint32_t));
-        memset(addr_table, 0, ADDR_TABLE_SIZE * sizeof(uint32_t));
+        addr_table = (uint32_t *)lazy_alloc(layout.table_size * sizeof(uint32_t));
         #endif
 
 
-        // no memset because informations is overrided.
-        addr_slots = (uint32_t *)std::aligned_alloc(64, ADDR_SLOTS_SIZE * sizeof(uint32_t));
+        row_blocks = (layout.table_size + MEM_ROW_BLOCK_SIZE - 1) >> MEM_ROW_BLOCK_BITS;
+        block_rows = new uint64_t[row_blocks];
+        memset(block_rows, 0, row_blocks * sizeof(uint64_t));
+        occupancy_words = (layout.table_size + 63) / 64;
+        occupancy = (uint64_t *)lazy_alloc(occupancy_words * sizeof(uint64_t));
+
+        own_arena = (arena == nullptr);
+        if (own_arena) {
+            this->arena = new MemSlotArena(ADDR_TOTAL_SLOTS / layout.partitions);
+        }
+        addr_slots = this->arena->get_slots();
         printf("CONSTRUCTOR Thread_%d addr_count:%d addr_count_table:%p addr_slots:%p\n", id, addr_count, addr_count_table, addr_slots);
 
         memset(first_offset, 0xFF, sizeof(first_offset));
         memset(last_offset, 0, sizeof(first_offset));
 
-        free_slot = 0;
+        // block 0 reserved, prev == 0 marks first block of a chain
+        slot_pos = 0;
+        slot_end = 0;
+        used_slots = 0;
         addr_count = 0;
     }
+    uint32_t get_id() const {
+        return id;
+    }
     uint32_t get_count() {
         return addr_count;
     }
     uint32_t get_used_slots() {
-        return free_slot;
+        return used_slots;
+    }
+    uint32_t get_magazines() const {
+        return magazines.size();
+    }
+    uint32_t get_slots_size() const {
+        return arena->get_size();
+    }
+    // records of prefetch window on count_entries, 0 = no prefetch
+    void set_count_window(uint32_t window) {
+        count_window = std::min(window, (uint32_t)MEM_FILTER_BATCH);
     }
-    uint32_t get_tot_usleep() {
-        return tot_usleep;
+    uint32_t get_count_window() const {
+        return count_window;
+    }
+    const MemPartitionLayout &get_layout() const {
+        return layout;
+    }
+    const MemWaitStats &get_wait_stats() const {
+        return wait_stats;
     }
     ~MemCounter() {
         #ifdef USE_ADDR_COUNT_TABLE
         printf("DESTRUCTOR Thread_%d addr_count:%d addr_count_table:%p addr_slots:%p\n", id, addr_count, addr_count_table, addr_slots);
-        free(addr_count_table);
+        lazy_free(addr_count_table, layout.table_size * sizeof(AddrCount));
         #else
-        free(addr_table);
+        lazy_free(addr_table, layout.table_size * sizeof(uint32_t));
         #endif
-        free(addr_slots);
+        delete [] block_rows;
+        lazy_free(occupancy, occupancy_words * sizeof(uint64_t));
+        if (own_arena) {
+            delete arena;
+        }
+    }
+    // prepares counter for a new trace, only offsets used by last one are cleared.
+    void reset() {
+        for (uint32_t page = 0; page < MAX_PAGES; ++page) {
+            if (first_offset[page] > last_offset[page]) continue;
+            #ifdef USE_ADDR_COUNT_TABLE
+            lazy_zero(addr_count_table + first_offset[page], (last_offset[page] - first_offset[page] + 1) * sizeof(AddrCount));
+            #else
+            lazy_zero(addr_table + first_offset[page], (last_offset[page] - first_offset[page] + 1) * sizeof(uint32_t));
+            #endif
+            lazy_zero(occupancy + (first_offset[page] >> 6), ((last_offset[page] >> 6) - (first_offset[page] >> 6) + 1) * sizeof(uint64_t));
+        }
+        memset(first_offset, 0xFF, sizeof(first_offset));
+        memset(last_offset, 0, sizeof(last_offset));
+        memset(block_rows, 0, row_blocks * sizeof(uint64_t));
+        for (auto first_block: magazines) {
+            arena->release(first_block);
+        }
+        magazines.clear();
+        overflow_counts.clear();
+        slot_pos = 0;
+        slot_end = 0;
+        used_slots = 0;
+        addr_count = 0;
+        count = 0;
+        unmapped_count = 0;
+        first_unmapped_addr = 0;
+        records = 0;
+        matched = 0;
+        chain_extensions = 0;
+        metrics.clear();
+        current_chunk = 0;
+        elapsed_ms = 0;
+        wait_stats.clear();
     }
     void execute() {
         uint64_t init = get_usec();
         const MemChunk *chunk;
         uint32_t chunk_id = 0;
-        while ((chunk = context->get_chunk(chunk_id)) != nullptr) {
+        while ((chunk = context->get_chunk(chunk_id, &wait_stats)) != nullptr) {
+            if (chunk->encoded != nullptr) {
+                uint32_t count;
+                const MemCountersBusData *data = decoder.decode(chunk->encoded, count);
+                execute_chunk(chunk_id, data, count);
+                ++chunk_id;
+                continue;
+            }
             execute_chunk(chunk_id, chunk->data, chunk->count);
             ++chunk_id;
         }
         elapsed_ms = ((get_usec() - init) / 1000);
     }
+    // same as execute, but reading only the stream of this counter from dispatcher
+    void execute_dispatched(MemDispatcher *dispatcher) {
+        uint64_t init = get_usec();
+        const MemDispatchEntry *entries;
+        uint32_t count;
+        uint32_t chunk_id = 0;
+        while ((entries = dispatcher->get_partition(chunk_id, id, count, &wait_stats)) != nullptr) {
+            execute_partition_chunk(chunk_id, entries, count);
+            dispatcher->release(chunk_id);
+            ++chunk_id;
+        }
+        elapsed_ms = ((get_usec() - init) / 1000);
+    }
+    // one thread counting several partitions, each chunk is read (and decoded) once by the
+    // group. Waits are accounted on first counter of group.
+    static void execute_group(const std::vector<MemCounter *> &group, MemDispatcher *dispatcher = nullptr) {
+        uint64_t init = get_usec();
+        MemCounter *leader = group[0];
+        uint32_t chunk_id = 0;
+        if (dispatcher != nullptr) {
+            const MemDispatchEntry *entries;
+            uint32_t count;
+            bool completed = false;
+            while (!completed) {
+                for (auto counter: group) {
+                    if ((entries = dispatcher->get_partition(chunk_id, counter->id, count, &leader->wait_stats)) == nullptr) {
+                        completed = true;
+                        break;
+                    }
+                    counter->execute_partition_chunk(chunk_id, entries, count);
+                    dispatcher->release(chunk_id);
+                }
+                ++chunk_id;
+            }
+        } else {
+            const MemChunk *chunk;
+            while ((chunk = leader->context->get_chunk(chunk_id, &leader->wait_stats)) != nullptr) {
+                const MemCountersBusData *data = chunk->data;
+                uint32_t count = chunk->count;
+                if (chunk->encoded != nullptr) {
+                    data = leader->decoder.decode(chunk->encoded, count);
+                }
+                for (auto counter: group) {
+                    counter->execute_chunk(chunk_id, data, count);
+                }
+                ++chunk_id;
+            }
+        }
+        uint32_t elapsed_ms = ((get_usec() - init) / 1000);
+        for (auto counter: group) {
+            counter->elapsed_ms = elapsed_ms;
+        }
+    }
+    void execute_partition_chunk(uint32_t chunk_id, const MemDispatchEntry *entries, uint32_t count) {
+        current_chunk = chunk_id;
+        records += count;
+        count_entries(chunk_id, entries, count);
+        publish_metrics(chunk_id + 1);
+    }
+    inline void count_entries(uint32_t chunk_id, const MemDispatchEntry *entries, uint32_t count) {
+        matched += count;
+        if (count_window == 0) {
+            for (const MemDispatchEntry *entries_eod = entries + count; entries != entries_eod; entries++) {
+                count_aligned(entries->addr, chunk_id, entries->count);
+            }
+            return;
+        }
+        for (uint32_t from = 0; from < count; from += MEM_FILTER_BATCH) {
+            count_entries_prefetched(chunk_id, entries + from, std::min((uint32_t)MEM_FILTER_BATCH, count - from));
+        }
+    }
+    // group prefetch: offsets of whole batch are translated first, then table entries are
+    // prefetched count_window records ahead and slot lines half window ahead. Records are
+    // still counted in order, so entries of same address keep chunk order.
+    void count_entries_prefetched(uint32_t chunk_id, const MemDispatchEntry *entries, uint32_t count) {
+        for (uint32_t index = 0; index < count; ++index) {
+            if (!region_map.try_addr_to_offset(entries[index].addr, window_offsets[index])) {
+                add_unmapped(entries[index].addr);
+                window_offsets[index] = NO_OFFSET;
+            }
+        }
+        const uint32_t window = count_window;
+        const uint32_t half_window = (window + 1) / 2;
+        for (uint32_t index = 0; index < std::min(window, count); ++index) {
+            prefetch_table(window_offsets[index]);
+        }
+        for (uint32_t index = 0; index < std::min(half_window, count); ++index) {
+            prefetch_slot(window_offsets[index]);
+        }
+        for (uint32_t index = 0; index < count; ++index) {
+            if (index + window < count) {
+                prefetch_table(window_offsets[index + window]);
+            }
+            if (index + half_window < count) {
+                prefetch_slot(window_offsets[index + half_window]);
+            }
+            if (window_offsets[index] != NO_OFFSET) {
+                count_offset(window_offsets[index], chunk_id, entries[index].count);
+            }
+        }
+    }
+    inline void prefetch_table(uint32_t offset) const {
+        if (offset == NO_OFFSET) return;
+        #ifdef USE_ADDR_COUNT_TABLE
+        __builtin_prefetch(addr_count_table + offset, 1, 3);
+        #else
+        __builtin_prefetch(addr_table + offset, 1, 3);
+        #endif
+    }
+    // only a hint, pos could change before record is counted
+    inline void prefetch_slot(uint32_t offset) const {
+        if (offset == NO_OFFSET) return;
+        uint32_t pos = get_addr_table(offset);
+        if (pos != 0) {
+            __builtin_prefetch(addr_slots + pos, 1, 3);
+        }
+    }
+    // vectorized filter (mem_counter_filter.hpp) selects records of this counter by batches,
+    // after that count_aligned runs over selected records.
     void execute_chunk(uint32_t chunk_id, const MemCountersBusData *chunk_data, uint32_t chunk_size) {
         current_chunk = chunk_id;
+        for (uint32_t from = 0; from < chunk_size; from += MEM_FILTER_BATCH) {
+            uint32_t count = mem_filter(chunk_data + from, std::min((uint32_t)MEM_FILTER_BATCH, chunk_size - from), layout, id, filter_buffer);
+            count_entries(chunk_id, filter_buffer, count);
+        }
+        records += chunk_size;
+        publish_metrics(chunk_id + 1);
+    }
+    void execute_chunk_scalar(uint32_t chunk_id, const MemCountersBusData *chunk_data, uint32_t chunk_size) {
+        current_chunk = chunk_id;
 
         for (const MemCountersBusData *chunk_eod = chunk_data + chunk_size; chunk_eod != chunk_data; chunk_data++) {
             const uint8_t bytes = chunk_data->flags & 0xFF;
             const uint32_t addr = chunk_data->addr;
-            // if (chunk_id == 1791 && addr >= 0xA7FFB780 && addr <= 0xA7FFB798) {
-            //     printf("##5 Thread %d addr 0x%08X & 0x%08X = 0x%08X ? 0x%08X bytes %d\n", id, addr, ADDR_MASK, addr & ADDR_MASK, addr_mask, bytes);
-            // }
             if (bytes == 8 && (addr & 0x07) == 0) {
                 // aligned access
-                if ((addr & ADDR_MASK) != addr_mask) {
+                if (layout.partition_of(addr) != id) {
                     continue;
                 }
+                ++matched;
                 count_aligned(addr, chunk_id, 1, 0);
             } else {
                 const uint32_t aligned_addr = addr & 0xFFFFFFF8;
-                if ((aligned_addr & ADDR_MASK) == addr_mask) {
-                    const int ops = 1 + (chunk_data->flags >> 16);
+                const int ops = 1 + (chunk_data->flags >> 16);
+                if (layout.partition_of(aligned_addr) == id) {
+                    ++matched;
                     count_aligned(aligned_addr, chunk_id, ops, 1);
                 }
-                else if ((bytes + (addr & 0x07)) > 8 && ((aligned_addr + 8) & ADDR_MASK) == addr_mask) {
-                    const int ops = 1 + (chunk_data->flags >> 16);
+                // with xor fold both addresses could be on same partition
+                if ((bytes + (addr & 0x07)) > 8 && layout.partition_of(aligned_addr + 8) == id) {
+                    ++matched;
                     count_aligned(aligned_addr + 8 , chunk_id, ops, 2);
                 }
             }
         }
+        records += chunk_size;
+        publish_metrics(chunk_id + 1);
+    }
+    void publish_metrics(uint32_t chunks) {
+        metrics.records.store(records, std::memory_order_relaxed);
+        metrics.matched.store(matched, std::memory_order_relaxed);
+        metrics.slot_allocs.store(used_slots, std::memory_order_relaxed);
+        metrics.chain_extensions.store(chain_extensions, std::memory_order_relaxed);
+        metrics.parked_us.store(wait_stats.parked_us, std::memory_order_relaxed);
+        metrics.spin_us.store(wait_stats.spin_us, std::memory_order_relaxed);
+        metrics.chunks.store(chunks, std::memory_order_relaxed);
+    }
+    const MemCounterMetrics &get_metrics() const {
+        return metrics;
     }
     inline uint32_t get_initial_block_pos(uint32_t pos) {
         uint32_t tpos = pos & ADDR_SLOT_MASK;
@@ -151,9 +404,9 @@ public:
 
     inline uint32_t get_initial_pos(uint32_t pos) const {
         uint32_t tpos = pos & ADDR_SLOT_MASK;
-        if (tpos >= ADDR_SLOTS_SIZE) {
+        if (tpos >= get_slots_size()) {
             std::ostringstream msg;
-            msg << "Error: get_initial_pos: " << tpos << " out of bounds " << ADDR_SLOTS_SIZE << " (pos:" << pos << ")\n";
+            msg << "Error: get_initial_pos: " << tpos << " out of bounds " << get_slots_size() << " (pos:" << pos << ")\n";
             throw std::runtime_error(msg.str());
         }
         if (addr_slots[tpos] == 0) {
@@ -163,11 +416,15 @@ public:
         }
     }
 
-    inline uint32_t get_pos_value(uint32_t pos) const {
-        return addr_slots[pos];
+    inline uint32_t get_pos_chunk(uint32_t pos) const {
+        return addr_slots[pos] & SLOT_ENTRY_CHUNK_MASK;
     }
-    inline uint32_t get_queue_full_times() const {
-        return queue_full;
+    inline uint32_t get_pos_count(uint32_t pos) const {
+        const uint32_t entry = addr_slots[pos];
+        if (entry & SLOT_ENTRY_ESCAPE) {
+            return overflow_counts[(entry & ~SLOT_ENTRY_ESCAPE) >> SLOT_ENTRY_CHUNK_BITS];
+        }
+        return entry >> SLOT_ENTRY_CHUNK_BITS;
     }
     inline uint32_t get_next_pos(uint32_t pos) const {
         int relative_pos = pos & (ADDR_SLOT_SIZE - 1);
@@ -187,6 +444,14 @@ public:
         return addr_table[index];
         #endif
     }
+    // rows (ops) counted on offsets [block << MEM_ROW_BLOCK_BITS, (block + 1) << MEM_ROW_BLOCK_BITS)
+    inline uint64_t get_block_rows(uint32_t block) const {
+        return block_rows[block];
+    }
+    // bit (offset & 63) of word (offset >> 6) is set when offset has an address table entry
+    inline const uint64_t *get_occupancy() const {
+        return occupancy;
+    }
     inline uint32_t get_count_table(uint32_t index) const {
         // return count_table[index];
         #ifdef USE_ADDR_COUNT_TABLE
@@ -196,15 +461,33 @@ public:
         #endif
     }
     inline uint32_t get_next_slot_pos() {
-        if (free_slot >= ADDR_SLOTS) {
-            std::ostringstream msg;
-            msg << "ERROR: MemCounter no more free slots on thread" << id;
-            throw std::runtime_error(msg.str());
+        if (slot_pos == slot_end) {
+            uint32_t first_block;
+            try {
+                first_block = arena->acquire();
+            } catch (const std::runtime_error &e) {
+                std::ostringstream msg;
+                msg << e.what() << " on thread " << id;
+                throw std::runtime_error(msg.str());
+            }
+            magazines.push_back(first_block);
+            // block 0 reserved, prev == 0 marks first block of a chain
+            slot_pos = first_block ? first_block : 1;
+            slot_end = first_block + MEM_SLOT_MAGAZINE_BLOCKS;
         }
-        return (free_slot++) * ADDR_SLOT_SIZE;
+        ++used_slots;
+        return (slot_pos++) * ADDR_SLOT_SIZE;
     }
     inline void count_aligned(uint32_t addr, uint32_t chunk_id, uint32_t count, uint32_t debug_id = 0) {
-        uint32_t offset = addr_to_offset(addr, current_chunk);
+        uint32_t offset;
+        if (!region_map.try_addr_to_offset(addr, offset)) {
+            add_unmapped(addr);
+            return;
+        }
+        count_offset(offset, chunk_id, count);
+    }
+    inline void count_offset(uint32_t offset, uint32_t chunk_id, uint32_t count) {
+        block_rows[offset >> MEM_ROW_BLOCK_BITS] += count;
         #ifdef USE_ADDR_COUNT_TABLE
         uint32_t pos = addr_count_table[offset].pos;
         #else
@@ -217,15 +500,15 @@ public:
             uint32_t pos = get_next_slot_pos();
             addr_slots[pos] = 0;
             addr_slots[pos + 1] = pos;
-            addr_slots[pos + 2] = chunk_id;
-            addr_slots[pos + 3] = count;
+            addr_slots[pos + 2] = make_entry(chunk_id, count);
             #ifdef USE_ADDR_COUNT_TABLE
             addr_count_table[offset].pos = pos + 2;
             addr_count_table[offset].count = count;
             #else
             addr_table[offset] = pos + 2;
             #endif
-            uint32_t page = offset >> ADDR_PAGE_BITS;
+            occupancy[offset >> 6] |= 1ULL << (offset & 63);
+            uint32_t page = offset >> layout.page_bits;
             first_offset[page] = std::min(first_offset[page], offset);
             last_offset[page] = std::max(last_offset[page], offset);
             ++addr_count;
@@ -233,17 +516,18 @@ public:
             #ifdef USE_ADDR_COUNT_TABLE
             addr_count_table[offset].count += count;
             #endif
-            if (addr_slots[pos] == chunk_id) {
-                addr_slots[pos + 1] += count;
+            const uint32_t entry = addr_slots[pos];
+            if ((entry & SLOT_ENTRY_CHUNK_MASK) == chunk_id) {
+                add_entry_count(pos, entry, count);
                 return;
             }
-            if ((pos % ADDR_SLOT_SIZE) == (ADDR_SLOT_SIZE - 2)) {
+            if ((pos % ADDR_SLOT_SIZE) == (ADDR_SLOT_SIZE - 1)) {
+                ++chain_extensions;
                 uint32_t npos = get_next_slot_pos();
-                uint32_t tpos = pos - ADDR_SLOT_SIZE + 2;
+                uint32_t tpos = pos & ADDR_SLOT_MASK;
                 addr_slots[npos] = tpos;
                 addr_slots[npos + 1] = addr_slots[tpos + 1];
-                addr_slots[npos + 2] = chunk_id;
-                addr_slots[npos + 3] = count;
+                addr_slots[npos + 2] = make_entry(chunk_id, count);
                 addr_slots[tpos + 1] = npos;
                 #ifdef USE_ADDR_COUNT_TABLE
                 addr_count_table[offset].pos = npos + 2;
@@ -252,116 +536,104 @@ public:
                 #endif
                 return;
             }
-            addr_slots[pos + 2] = chunk_id;
-            addr_slots[pos + 3] = count;
+            addr_slots[pos + 1] = make_entry(chunk_id, count);
             #ifdef USE_ADDR_COUNT_TABLE
-            addr_count_table[offset].pos = pos + 2;
+            addr_count_table[offset].pos = pos + 1;
             #else
-            addr_table[offset] = pos + 2;
+            addr_table[offset] = pos + 1;
             #endif
         }
     }
+    inline uint32_t make_entry(uint32_t chunk_id, uint32_t count) {
+        if (count > SLOT_ENTRY_MAX_COUNT) {
+            return make_escaped_entry(chunk_id, count);
+        }
+        return chunk_id | (count << SLOT_ENTRY_CHUNK_BITS);
+    }
+    inline void add_entry_count(uint32_t pos, uint32_t entry, uint32_t count) {
+        if (entry & SLOT_ENTRY_ESCAPE) {
+            overflow_counts[(entry & ~SLOT_ENTRY_ESCAPE) >> SLOT_ENTRY_CHUNK_BITS] += count;
+            return;
+        }
+        addr_slots[pos] = make_entry(entry & SLOT_ENTRY_CHUNK_MASK, (entry >> SLOT_ENTRY_CHUNK_BITS) + count);
+    }
+    uint32_t make_escaped_entry(uint32_t chunk_id, uint32_t count) {
+        uint32_t index = overflow_counts.size();
+        if (index > SLOT_ENTRY_MAX_COUNT) {
+            std::ostringstream msg;
+            msg << "ERROR: MemCounter overflow table full on thread " << id;
+            throw std::runtime_error(msg.str());
+        }
+        overflow_counts.push_back(count);
+        return SLOT_ENTRY_ESCAPE | chunk_id | (index << SLOT_ENTRY_CHUNK_BITS);
+    }
+    // accesses out of regions aren't counted, only reported on stats
+    void add_unmapped(uint32_t addr) {
+        if (unmapped_count++ == 0) {
+            first_unmapped_addr = addr;
+        }
+    }
+    void add_unmapped(uint32_t count, uint32_t first_addr) {
+        if (count == 0) return;
+        if (unmapped_count == 0) {
+            first_unmapped_addr = first_addr;
+        }
+        unmapped_count += count;
+    }
+    // records read and entries counted (accesses crossing 8 bytes count on both partitions)
+    void add_records(uint64_t read, uint64_t counted) {
+        records += read;
+        matched += counted;
+    }
+    uint64_t get_records() const {
+        return records;
+    }
+    uint64_t get_matched() const {
+        return matched;
+    }
+    uint32_t get_unmapped_count(uint32_t &first_addr) const {
+        first_addr = first_unmapped_addr;
+        return unmapped_count;
+    }
     uint32_t get_elapsed_ms() {
         return elapsed_ms;
     }
-    inline static uint32_t offset_to_page(uint32_t offset) {
-        return (offset >> ADDR_PAGE_BITS);
+    void set_elapsed_ms(uint32_t value) {
+        elapsed_ms = value;
+    }
+    inline uint32_t offset_to_page(uint32_t offset) const {
+        return (offset >> layout.page_bits);
     }
 
-    inline static void offset_info(uint32_t offset, uint32_t &page, uint32_t &addr, uint32_t thread_index) {
-        page = offset >> ADDR_PAGE_BITS;
-        uint32_t base_addr = page_to_addr(page);
-        addr = ((offset & RELATIVE_OFFSET_MASK) << ADDR_LOW_BITS) + base_addr + thread_index * 8;
+    inline void offset_info(uint32_t offset, uint32_t &page, uint32_t &addr, uint32_t thread_index) const {
+        page = offset >> layout.page_bits;
+        uint32_t base_addr = region_map.page_to_addr(page);
+        addr = ((offset & layout.relative_offset_mask) << layout.addr_low_bits) + base_addr + thread_index * 8;
     }
 
-    inline static uint32_t offset_to_addr(uint32_t offset, uint32_t thread_index) {
-        uint32_t page = offset >> ADDR_PAGE_BITS;
-        uint32_t base_addr = page_to_addr(page);
-        return ((offset & RELATIVE_OFFSET_MASK) << ADDR_LOW_BITS) + base_addr + thread_index * 8;
+    inline uint32_t offset_to_addr(uint32_t offset, uint32_t thread_index) const {
+        uint32_t page = offset >> layout.page_bits;
+        uint32_t base_addr = region_map.page_to_addr(page);
+        return ((offset & layout.relative_offset_mask) << layout.addr_low_bits) + base_addr + thread_index * 8;
     }
 
-    inline static uint32_t addr_to_offset(uint32_t addr, uint32_t chunk_id = 0, uint32_t index = 0) {
-        switch((uint8_t)((addr >> 24) & 0xFC)) {
-            case 0x80: return ((addr - 0x80000000) >> (ADDR_LOW_BITS));
-            case 0x84: return ((addr - 0x84000000) >> (ADDR_LOW_BITS)) + ADDR_PAGE_SIZE;
-            case 0x90: return ((addr - 0x90000000) >> (ADDR_LOW_BITS)) + 2 * ADDR_PAGE_SIZE;
-            case 0x94: return ((addr - 0x94000000) >> (ADDR_LOW_BITS)) + 3 * ADDR_PAGE_SIZE;
-            case 0xA0: return ((addr - 0xA0000000) >> (ADDR_LOW_BITS)) + 4 * ADDR_PAGE_SIZE;
-            case 0xA4: return ((addr - 0xA4000000) >> (ADDR_LOW_BITS)) + 5 * ADDR_PAGE_SIZE;
-            case 0xA8: return ((addr - 0xA8000000) >> (ADDR_LOW_BITS)) + 6 * ADDR_PAGE_SIZE;
-            case 0xAC: return ((addr - 0xAC000000) >> (ADDR_LOW_BITS)) + 7 * ADDR_PAGE_SIZE;
-            case 0xB0: return ((addr - 0xB0000000) >> (ADDR_LOW_BITS)) + 8 * ADDR_PAGE_SIZE;
-            case 0xB4: return ((addr - 0xB4000000) >> (ADDR_LOW_BITS)) + 9 * ADDR_PAGE_SIZE;
-            case 0xB8: return ((addr - 0xB8000000) >> (ADDR_LOW_BITS)) + 10 * ADDR_PAGE_SIZE;
-            case 0xBC: return ((addr - 0xBC000000) >> (ADDR_LOW_BITS)) + 11 * ADDR_PAGE_SIZE;
-            case 0xC0: return ((addr - 0xC0000000) >> (ADDR_LOW_BITS)) + 12 * ADDR_PAGE_SIZE;
-            case 0xC4: return ((addr - 0xC4000000) >> (ADDR_LOW_BITS)) + 13 * ADDR_PAGE_SIZE;
-            case 0xC8: return ((addr - 0xC8000000) >> (ADDR_LOW_BITS)) + 14 * ADDR_PAGE_SIZE;
-            case 0xCC: return ((addr - 0xCC000000) >> (ADDR_LOW_BITS)) + 15 * ADDR_PAGE_SIZE;
-            case 0xD0: return ((addr - 0xD0000000) >> (ADDR_LOW_BITS)) + 16 * ADDR_PAGE_SIZE;
-            case 0xD4: return ((addr - 0xD4000000) >> (ADDR_LOW_BITS)) + 17 * ADDR_PAGE_SIZE;
-            case 0xD8: return ((addr - 0xD8000000) >> (ADDR_LOW_BITS)) + 18 * ADDR_PAGE_SIZE;
-            case 0xDC: return ((addr - 0xDC000000) >> (ADDR_LOW_BITS)) + 19 * ADDR_PAGE_SIZE;
-        }
-        std::ostringstream msg;
-        msg << "ERROR: addr_to_offset: 0x" << std::hex << addr << " (" << std::dec << chunk_id << ")";
-        throw std::runtime_error(msg.str());
+    // partition of lanes on block of offset is lane ^ lane_fold(offset)
+    inline uint32_t lane_fold(uint32_t offset) const {
+        if (layout.function == MEM_PARTITION_LANE) {
+            return 0;
+        }
+        return layout.fold_of(offset_to_addr(offset, 0));
+    }
+
+    inline uint32_t addr_to_offset(uint32_t addr, uint32_t chunk_id = 0) const {
+        return region_map.addr_to_offset(addr, chunk_id);
     }
 
     inline static uint32_t addr_to_page(uint32_t addr, uint32_t chunk_id = 0, uint32_t index = 0) {
-        switch((uint8_t)((addr >> 24) & 0xFC)) {
-            case 0x80: return 0;
-            case 0x84: return 1;
-            case 0x90: return 2;
-            case 0x94: return 3;
-            case 0xA0: return 4;
-            case 0xA4: return 5;
-            case 0xA8: return 6;
-            case 0xAC: return 7;
-            case 0xB0: return 8;
-            case 0xB4: return 9;
-            case 0xB8: return 10;
-            case 0xBC: return 11;
-            case 0xC0: return 12;
-            case 0xC4: return 13;
-            case 0xC8: return 14;
-            case 0xCC: return 15;
-            case 0xD0: return 16;
-            case 0xD4: return 17;
-            case 0xD8: return 18;
-            case 0xDC: return 19;
-        }
-        std::ostringstream msg;
-        msg << "ERROR: addr_to_page: 0x" << std::hex << addr << " (" << std::dec << chunk_id << ":" << index << ")";
-        throw std::runtime_error(msg.str());
-    }
-    inline static uint32_t page_to_addr(uint8_t page) {
-        switch(page) {
-            case 0: return 0x80000000;
-            case 1: return 0x84000000;
-            case 2: return 0x90000000;
-            case 3: return 0x94000000;
-            case 4: return 0xA0000000;
-            case 5: return 0xA4000000;
-            case 6: return 0xA8000000;
-            case 7: return 0xAC000000;
-            case 8: return 0xB0000000;
-            case 9: return 0xB4000000;
-            case 10: return 0xB8000000;
-            case 11: return 0xBC000000;
-            case 12: return 0xC0000000;
-            case 13: return 0xC4000000;
-            case 14: return 0xC8000000;
-            case 15: return 0xCC000000;
-            case 16: return 0xD0000000;
-            case 17: return 0xD4000000;
-            case 18: return 0xD8000000;
-            case 19: return 0xDC000000;
-            case 0xFF: return 0xFFFFFFFF;
-        }
-        std::ostringstream msg;
-        msg << "ERROR: MemCounter page_to_address page:" << page;
-        throw std::runtime_error(msg.str());
+        return MemRegionMap::get_default().addr_to_page(addr, chunk_id, index);
+    }
+    inline static uint32_t page_to_addr(uint32_t page) {
+        return MemRegionMap::get_default().page_to_addr(page);
     }
 };
 #endif
\ No newline at end of file
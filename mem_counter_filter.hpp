@@ -0,0 +1,214 @@
+#ifndef __MEM_COUNTER_FILTER_HPP__
+#define __MEM_COUNTER_FILTER_HPP__
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "mem_types.hpp"
+#include "mem_config.hpp"
+#include "mem_partition.hpp"
+#include "mem_dispatcher.hpp"
+
+// Front end of MemCounter::execute_chunk, selects records of one counter (layout.partition_of
+// == partition) and writes their aligned address and ops on out, in same order. For each record:
+//
+//   aligned access (8 bytes, addr % 8 == 0): addr if it belongs to counter, count 1
+//   unaligned access: aligned addr if it belongs to counter, and aligned addr + 8 if access
+//   crosses 8 bytes boundary and it belongs to counter, count 1 + (flags >> 16)
+//
+// with lane partitions each record produces at most one entry, with xor fold both addresses of
+// an access crossing a block could be on same partition (vector paths leave these groups to
+// scalar). out must have space for 2 * count + MEM_FILTER_SLACK.
+
+#define MEM_FILTER_SLACK 16
+
+inline uint32_t mem_filter_scalar(const MemCountersBusData *chunk_data, uint32_t count, const MemPartitionLayout &layout, uint32_t partition, MemDispatchEntry *out) {
+    MemDispatchEntry *out_init = out;
+    for (const MemCountersBusData *chunk_eod = chunk_data + count; chunk_eod != chunk_data; chunk_data++) {
+        const uint8_t bytes = chunk_data->flags & 0xFF;
+        const uint32_t addr = chunk_data->addr;
+        if (bytes == 8 && (addr & 0x07) == 0) {
+            if (layout.partition_of(addr) != partition) {
+                continue;
+            }
+            *(out++) = MemDispatchEntry{addr, 1};
+        } else {
+            const uint32_t aligned_addr = addr & 0xFFFFFFF8;
+            if (layout.partition_of(aligned_addr) == partition) {
+                *(out++) = MemDispatchEntry{aligned_addr, 1 + (chunk_data->flags >> 16)};
+            }
+            if ((bytes + (addr & 0x07)) > 8 && layout.partition_of(aligned_addr + 8) == partition) {
+                *(out++) = MemDispatchEntry{aligned_addr + 8, 1 + (chunk_data->flags >> 16)};
+            }
+        }
+    }
+    return out - out_init;
+}
+
+#ifdef __AVX2__
+// permutation to move selected lanes to front, 3 bits by lane, indexed by lane mask
+struct MemFilterCompressTable {
+    uint32_t perm[256];
+    MemFilterCompressTable() {
+        for (uint32_t mask = 0; mask < 256; ++mask) {
+            uint32_t value = 0;
+            uint32_t index = 0;
+            for (uint32_t lane = 0; lane < 8; ++lane) {
+                if (mask & (1 << lane)) {
+                    value |= lane << (3 * index++);
+                }
+            }
+            perm[mask] = value;
+        }
+    }
+};
+
+// partition key of 8 addresses, (addr & addr_mask) ^ fold << 3, compared with partition * 8
+inline __m256i mem_filter_key_avx2(__m256i addr, const MemPartitionLayout &layout, __m256i v_partition_mask, __m256i v_fold_mask) {
+    __m256i key = _mm256_and_si256(addr, v_partition_mask);
+    if (layout.function == MEM_PARTITION_XOR_FOLD) {
+        const __m256i block = _mm256_srl_epi32(addr, _mm_cvtsi32_si128(layout.addr_low_bits));
+        __m256i fold = block;
+        for (uint32_t shift = layout.bits; shift < 32 - layout.addr_low_bits; shift += layout.bits) {
+            fold = _mm256_xor_si256(fold, _mm256_srl_epi32(block, _mm_cvtsi32_si128(shift)));
+        }
+        key = _mm256_xor_si256(key, _mm256_slli_epi32(_mm256_and_si256(fold, v_fold_mask), 3));
+    }
+    return key;
+}
+
+inline uint32_t mem_filter_avx2(const MemCountersBusData *chunk_data, uint32_t count, const MemPartitionLayout &layout, uint32_t partition, MemDispatchEntry *out) {
+    static const MemFilterCompressTable table;
+    MemDispatchEntry *out_init = out;
+    const __m256i v_addr_mask = _mm256_set1_epi32(partition * 8);
+    const __m256i v_partition_mask = _mm256_set1_epi32(layout.addr_mask);
+    const __m256i v_fold_mask = _mm256_set1_epi32(layout.partitions - 1);
+    const __m256i v_align_mask = _mm256_set1_epi32(0xFFFFFFF8);
+    const __m256i v_0xff = _mm256_set1_epi32(0xFF);
+    const __m256i v_7 = _mm256_set1_epi32(7);
+    const __m256i v_8 = _mm256_set1_epi32(8);
+    const __m256i v_1 = _mm256_set1_epi32(1);
+    const __m256i v_zero = _mm256_setzero_si256();
+    const __m256i v_perm_shift = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+    uint32_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i r0 = _mm256_loadu_si256((const __m256i *)(chunk_data + i));
+        __m256i r1 = _mm256_loadu_si256((const __m256i *)(chunk_data + i + 4));
+        // deinterleave 8 records in addr and flags, keeping record order
+        __m256i addr = _mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(r0), _mm256_castsi256_ps(r1), _MM_SHUFFLE(2, 0, 2, 0)));
+        __m256i flags = _mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(r0), _mm256_castsi256_ps(r1), _MM_SHUFFLE(3, 1, 3, 1)));
+        addr = _mm256_permute4x64_epi64(addr, _MM_SHUFFLE(3, 1, 2, 0));
+        flags = _mm256_permute4x64_epi64(flags, _MM_SHUFFLE(3, 1, 2, 0));
+
+        __m256i bytes = _mm256_and_si256(flags, v_0xff);
+        __m256i offset = _mm256_and_si256(addr, v_7);
+        __m256i aligned = _mm256_and_si256(_mm256_cmpeq_epi32(bytes, v_8), _mm256_cmpeq_epi32(offset, v_zero));
+        __m256i aligned_addr = _mm256_and_si256(addr, v_align_mask);
+        __m256i next_addr = _mm256_add_epi32(aligned_addr, v_8);
+        __m256i match = _mm256_cmpeq_epi32(mem_filter_key_avx2(aligned_addr, layout, v_partition_mask, v_fold_mask), v_addr_mask);
+        __m256i next_match = _mm256_cmpeq_epi32(mem_filter_key_avx2(next_addr, layout, v_partition_mask, v_fold_mask), v_addr_mask);
+        __m256i cross = _mm256_cmpgt_epi32(_mm256_add_epi32(bytes, offset), v_8);
+        if (!_mm256_testz_si256(_mm256_andnot_si256(aligned, match), _mm256_and_si256(cross, next_match))) {
+            out += mem_filter_scalar(chunk_data + i, 8, layout, partition, out);
+            continue;
+        }
+        // straddle = !aligned && !match && cross && next_match
+        __m256i straddle = _mm256_andnot_si256(_mm256_or_si256(aligned, match), _mm256_and_si256(cross, next_match));
+        __m256i valid = _mm256_or_si256(match, straddle);
+        uint32_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(valid));
+        if (mask == 0) continue;
+
+        __m256i out_addr = _mm256_blendv_epi8(next_addr, aligned_addr, match);
+        __m256i ops = _mm256_blendv_epi8(_mm256_add_epi32(v_1, _mm256_srli_epi32(flags, 16)), v_1, aligned);
+
+        __m256i perm = _mm256_and_si256(_mm256_srlv_epi32(_mm256_set1_epi32(table.perm[mask]), v_perm_shift), v_7);
+        out_addr = _mm256_permutevar8x32_epi32(out_addr, perm);
+        ops = _mm256_permutevar8x32_epi32(ops, perm);
+        __m256i lo = _mm256_unpacklo_epi32(out_addr, ops);
+        __m256i hi = _mm256_unpackhi_epi32(out_addr, ops);
+        _mm256_storeu_si256((__m256i *)out, _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(out + 4), _mm256_permute2x128_si256(lo, hi, 0x31));
+        out += __builtin_popcount(mask);
+    }
+    return (out - out_init) + mem_filter_scalar(chunk_data + i, count - i, layout, partition, out);
+}
+#endif
+
+#ifdef __AVX512F__
+inline __m512i mem_filter_key_avx512(__m512i addr, const MemPartitionLayout &layout, __m512i v_partition_mask, __m512i v_fold_mask) {
+    __m512i key = _mm512_and_si512(addr, v_partition_mask);
+    if (layout.function == MEM_PARTITION_XOR_FOLD) {
+        // maskz shifts (all lanes) as in mem_filter_avx512
+        const __m512i block = _mm512_maskz_srl_epi32(0xFFFF, addr, _mm_cvtsi32_si128(layout.addr_low_bits));
+        __m512i fold = block;
+        for (uint32_t shift = layout.bits; shift < 32 - layout.addr_low_bits; shift += layout.bits) {
+            fold = _mm512_xor_si512(fold, _mm512_maskz_srl_epi32(0xFFFF, block, _mm_cvtsi32_si128(shift)));
+        }
+        key = _mm512_xor_si512(key, _mm512_maskz_slli_epi32(0xFFFF, _mm512_and_si512(fold, v_fold_mask), 3));
+    }
+    return key;
+}
+
+inline uint32_t mem_filter_avx512(const MemCountersBusData *chunk_data, uint32_t count, const MemPartitionLayout &layout, uint32_t partition, MemDispatchEntry *out) {
+    MemDispatchEntry *out_init = out;
+    const __m512i v_addr_mask = _mm512_set1_epi32(partition * 8);
+    const __m512i v_partition_mask = _mm512_set1_epi32(layout.addr_mask);
+    const __m512i v_fold_mask = _mm512_set1_epi32(layout.partitions - 1);
+    const __m512i v_align_mask = _mm512_set1_epi32(0xFFFFFFF8);
+    const __m512i v_0xff = _mm512_set1_epi32(0xFF);
+    const __m512i v_7 = _mm512_set1_epi32(7);
+    const __m512i v_8 = _mm512_set1_epi32(8);
+    const __m512i v_1 = _mm512_set1_epi32(1);
+    const __m512i v_even = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+    const __m512i v_odd = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+    const __m512i v_lo = _mm512_setr_epi32(0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+    const __m512i v_hi = _mm512_setr_epi32(8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31);
+    uint32_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512i r0 = _mm512_loadu_si512((const void *)(chunk_data + i));
+        __m512i r1 = _mm512_loadu_si512((const void *)(chunk_data + i + 8));
+        __m512i addr = _mm512_permutex2var_epi32(r0, v_even, r1);
+        __m512i flags = _mm512_permutex2var_epi32(r0, v_odd, r1);
+
+        __m512i bytes = _mm512_and_si512(flags, v_0xff);
+        __m512i offset = _mm512_and_si512(addr, v_7);
+        __mmask16 aligned = _mm512_cmpeq_epi32_mask(bytes, v_8) & _mm512_cmpeq_epi32_mask(offset, _mm512_setzero_si512());
+        __m512i aligned_addr = _mm512_and_si512(addr, v_align_mask);
+        __m512i next_addr = _mm512_add_epi32(aligned_addr, v_8);
+        __mmask16 match = _mm512_cmpeq_epi32_mask(mem_filter_key_avx512(aligned_addr, layout, v_partition_mask, v_fold_mask), v_addr_mask);
+        __mmask16 next_match = _mm512_cmpeq_epi32_mask(mem_filter_key_avx512(next_addr, layout, v_partition_mask, v_fold_mask), v_addr_mask);
+        __mmask16 cross = _mm512_cmpgt_epi32_mask(_mm512_add_epi32(bytes, offset), v_8);
+        if (~aligned & match & cross & next_match) {
+            out += mem_filter_scalar(chunk_data + i, 16, layout, partition, out);
+            continue;
+        }
+        __mmask16 straddle = ~(aligned | match) & cross & next_match;
+        __mmask16 valid = match | straddle;
+        if (valid == 0) continue;
+
+        __m512i out_addr = _mm512_mask_blend_epi32(match, next_addr, aligned_addr);
+        // maskz shift (all lanes), unmasked form passes an undefined vector (maybe-uninitialized on gcc)
+        __m512i ops = _mm512_mask_blend_epi32(aligned, _mm512_add_epi32(v_1, _mm512_maskz_srli_epi32(0xFFFF, flags, 16)), v_1);
+        out_addr = _mm512_maskz_compress_epi32(valid, out_addr);
+        ops = _mm512_maskz_compress_epi32(valid, ops);
+        _mm512_storeu_si512((void *)out, _mm512_permutex2var_epi32(out_addr, v_lo, ops));
+        _mm512_storeu_si512((void *)(out + 8), _mm512_permutex2var_epi32(out_addr, v_hi, ops));
+        out += __builtin_popcount(valid);
+    }
+    return (out - out_init) + mem_filter_scalar(chunk_data + i, count - i, layout, partition, out);
+}
+#endif
+
+inline uint32_t mem_filter(const MemCountersBusData *chunk_data, uint32_t count, const MemPartitionLayout &layout, uint32_t partition, MemDispatchEntry *out) {
+    #if defined(MEM_FILTER_SCALAR)
+    return mem_filter_scalar(chunk_data, count, layout, partition, out);
+    #elif defined(__AVX512F__)
+    return mem_filter_avx512(chunk_data, count, layout, partition, out);
+    #elif defined(__AVX2__)
+    return mem_filter_avx2(chunk_data, count, layout, partition, out);
+    #else
+    return mem_filter_scalar(chunk_data, count, layout, partition, out);
+    #endif
+}
+
+#endif
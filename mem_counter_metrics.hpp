@@ -0,0 +1,45 @@
+#ifndef __MEM_COUNTER_METRICS_HPP__
+#define __MEM_COUNTER_METRICS_HPP__
+
+#include <stdint.h>
+#include <atomic>
+#include <sstream>
+
+// Live metrics of a MemCounter, written by counter thread once by chunk and readable from any
+// thread without locks (relaxed, values of different fields could be from different chunks).
+struct MemCounterMetrics {
+    std::atomic<uint32_t> chunks;               // chunks completed
+    std::atomic<uint64_t> records;              // records read (whole chunks or dispatched stream)
+    std::atomic<uint64_t> matched;              // entries counted on this partition
+    std::atomic<uint64_t> slot_allocs;          // slot blocks allocated
+    std::atomic<uint64_t> chain_extensions;     // blocks added to an existing chain
+    std::atomic<uint64_t> parked_us;            // time parked waiting chunks
+    std::atomic<uint64_t> spin_us;              // time spinning waiting chunks
+    MemCounterMetrics() {
+        clear();
+    }
+    void clear() {
+        chunks.store(0, std::memory_order_relaxed);
+        records.store(0, std::memory_order_relaxed);
+        matched.store(0, std::memory_order_relaxed);
+        slot_allocs.store(0, std::memory_order_relaxed);
+        chain_extensions.store(0, std::memory_order_relaxed);
+        parked_us.store(0, std::memory_order_relaxed);
+        spin_us.store(0, std::memory_order_relaxed);
+    }
+    // lag: chunks available on context not yet completed by counter
+    void to_json(std::ostringstream &out, uint32_t id, uint32_t available_chunks) const {
+        uint32_t done = chunks.load(std::memory_order_relaxed);
+        out << "{\"id\":" << id
+            << ",\"chunks\":" << done
+            << ",\"lag\":" << (available_chunks > done ? available_chunks - done : 0)
+            << ",\"records\":" << records.load(std::memory_order_relaxed)
+            << ",\"matched\":" << matched.load(std::memory_order_relaxed)
+            << ",\"slot_allocs\":" << slot_allocs.load(std::memory_order_relaxed)
+            << ",\"chain_extensions\":" << chain_extensions.load(std::memory_order_relaxed)
+            << ",\"parked_us\":" << parked_us.load(std::memory_order_relaxed)
+            << ",\"spin_us\":" << spin_us.load(std::memory_order_relaxed) << "}";
+    }
+};
+
+#endif
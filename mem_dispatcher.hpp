@@ -0,0 +1,172 @@
+#ifndef __MEM_DISPATCHER_HPP__
+#define __MEM_DISPATCHER_HPP__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <atomic>
+#include <stdexcept>
+#include <sstream>
+
+#include "mem_types.hpp"
+#include "mem_config.hpp"
+#include "mem_context.hpp"
+#include "mem_partition.hpp"
+#include "mem_signal.hpp"
+#include "mem_trace_codec.hpp"
+#include "tools.hpp"
+
+struct MemDispatchEntry {
+    uint32_t addr;  // aligned address
+    uint32_t count; // ops over this address
+};
+
+struct MemDispatchChunk {
+    MemDispatchEntry *entries;
+    uint32_t partition_from[MAX_PARTITIONS + 1];
+    std::atomic<uint32_t> ready;
+    std::atomic<uint32_t> pending;
+};
+
+// Optional stage between context and counters, splits each chunk once in layout.partitions
+// streams of aligned accesses, one by counter. Unaligned accesses that cross 8 bytes
+// boundary go to both streams. Dispatch threads take chunks in any order, counters
+// read their stream chunk by chunk in order.
+class MemDispatcher {
+private:
+    MemContext *context;
+    const MemPartitionLayout layout;
+    MemDispatchChunk *chunks;
+    std::atomic<uint32_t> next_chunk;
+    MemSignal signal;
+    std::atomic<uint32_t> elapsed_ms;
+public:
+    MemDispatcher(MemContext *context, const MemPartitionLayout &layout) : context(context), layout(layout), next_chunk(0), elapsed_ms(0) {
+        chunks = new MemDispatchChunk[MAX_CHUNKS];
+        for (uint32_t chunk_id = 0; chunk_id < MAX_CHUNKS; ++chunk_id) {
+            chunks[chunk_id].entries = nullptr;
+            chunks[chunk_id].ready.store(0, std::memory_order_relaxed);
+            chunks[chunk_id].pending.store(0, std::memory_order_relaxed);
+        }
+    }
+    ~MemDispatcher() {
+        clear();
+        delete [] chunks;
+    }
+    void clear() {
+        for (uint32_t chunk_id = 0; chunk_id < MAX_CHUNKS; ++chunk_id) {
+            free(chunks[chunk_id].entries);
+            chunks[chunk_id].entries = nullptr;
+            chunks[chunk_id].ready.store(0, std::memory_order_relaxed);
+            chunks[chunk_id].pending.store(0, std::memory_order_relaxed);
+        }
+        next_chunk.store(0, std::memory_order_release);
+    }
+    void reset() {
+        clear();
+        elapsed_ms.store(0, std::memory_order_relaxed);
+    }
+    void set_spin_budget(uint32_t spin_budget) {
+        signal.set_spin_budget(spin_budget);
+    }
+    // dispatch thread, many could run concurrently
+    void execute() {
+        uint64_t init = get_usec();
+        MemTraceDecoder decoder;
+        const MemChunk *chunk;
+        uint32_t chunk_id;
+        while ((chunk_id = next_chunk.fetch_add(1, std::memory_order_relaxed)) < MAX_CHUNKS &&
+               (chunk = context->get_chunk(chunk_id)) != nullptr) {
+            if (chunk->encoded != nullptr) {
+                uint32_t count;
+                const MemCountersBusData *data = decoder.decode(chunk->encoded, count);
+                dispatch_chunk(chunk_id, data, count);
+            } else {
+                dispatch_chunk(chunk_id, chunk->data, chunk->count);
+            }
+            chunks[chunk_id].ready.store(1, std::memory_order_release);
+            signal.notify();
+        }
+        // wake up counters waiting a chunk that never arrives
+        signal.notify_always();
+        elapsed_ms.store((get_usec() - init) / 1000, std::memory_order_relaxed);
+    }
+    void dispatch_chunk(uint32_t chunk_id, const MemCountersBusData *chunk_data, uint32_t chunk_size) {
+        MemDispatchChunk &dchunk = chunks[chunk_id];
+        uint32_t counts[MAX_PARTITIONS] = {0};
+        for (uint32_t i = 0; i < chunk_size; ++i) {
+            const uint8_t bytes = chunk_data[i].flags & 0xFF;
+            const uint32_t addr = chunk_data[i].addr;
+            const uint32_t aligned_addr = addr & 0xFFFFFFF8;
+            ++counts[layout.partition_of(aligned_addr)];
+            if (bytes != 8 || (addr & 0x07) != 0) {
+                if ((bytes + (addr & 0x07)) > 8) {
+                    ++counts[layout.partition_of(aligned_addr + 8)];
+                }
+            }
+        }
+        uint32_t pos[MAX_PARTITIONS];
+        uint32_t total = 0;
+        for (uint32_t partition = 0; partition < layout.partitions; ++partition) {
+            dchunk.partition_from[partition] = total;
+            pos[partition] = total;
+            total += counts[partition];
+        }
+        dchunk.partition_from[layout.partitions] = total;
+        MemDispatchEntry *entries = (MemDispatchEntry *)malloc((total ? total : 1) * sizeof(MemDispatchEntry));
+        if (entries == nullptr) {
+            std::ostringstream msg;
+            msg << "ERROR: MemDispatcher no memory to dispatch chunk " << chunk_id;
+            throw std::runtime_error(msg.str());
+        }
+        for (uint32_t i = 0; i < chunk_size; ++i) {
+            const uint8_t bytes = chunk_data[i].flags & 0xFF;
+            const uint32_t addr = chunk_data[i].addr;
+            if (bytes == 8 && (addr & 0x07) == 0) {
+                entries[pos[layout.partition_of(addr)]++] = MemDispatchEntry{addr, 1};
+                continue;
+            }
+            const uint32_t aligned_addr = addr & 0xFFFFFFF8;
+            const uint32_t ops = 1 + (chunk_data[i].flags >> 16);
+            entries[pos[layout.partition_of(aligned_addr)]++] = MemDispatchEntry{aligned_addr, ops};
+            if ((bytes + (addr & 0x07)) > 8) {
+                entries[pos[layout.partition_of(aligned_addr + 8)]++] = MemDispatchEntry{aligned_addr + 8, ops};
+            }
+        }
+        dchunk.entries = entries;
+        dchunk.pending.store(layout.partitions, std::memory_order_relaxed);
+    }
+    // returns entries of partition for chunk_id, or nullptr when no more chunks.
+    const MemDispatchEntry *get_partition(uint32_t chunk_id, uint32_t partition, uint32_t &count, MemWaitStats *wait_stats = nullptr) {
+        if (chunk_id >= MAX_CHUNKS) {
+            return nullptr;
+        }
+        MemDispatchChunk &dchunk = chunks[chunk_id];
+        if (!dchunk.ready.load(std::memory_order_acquire)) {
+            signal.wait([this, &dchunk, chunk_id]() {
+                return dchunk.ready.load(std::memory_order_acquire) ||
+                       (context->chunks_completed.load(std::memory_order_acquire) && chunk_id >= context->size());
+            }, wait_stats);
+            if (!dchunk.ready.load(std::memory_order_acquire)) {
+                return nullptr;
+            }
+        }
+        count = dchunk.partition_from[partition + 1] - dchunk.partition_from[partition];
+        return dchunk.entries + dchunk.partition_from[partition];
+    }
+    // called by each counter when its partition of chunk_id was processed
+    void release(uint32_t chunk_id) {
+        MemDispatchChunk &dchunk = chunks[chunk_id];
+        if (dchunk.pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            free(dchunk.entries);
+            dchunk.entries = nullptr;
+        }
+    }
+    uint32_t get_elapsed_ms() {
+        return elapsed_ms.load(std::memory_order_relaxed);
+    }
+};
+
+#endif
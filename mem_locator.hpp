@@ -22,11 +22,11 @@
 #include "tools.hpp"
 #include "mem_counter.hpp"
 
+// start of a segment, entry is position on address index (MemAddrIndex), skip rows of chunk on cpos
 struct MemLocator {
-    uint32_t offset;
+    uint32_t entry;
     uint32_t cpos;
     uint32_t skip;
-    uint32_t thread_index;
 };
 
 #endif
\ No newline at end of file
@@ -14,6 +14,7 @@
 #include <map>
 #include <unordered_map>
 #include <stdexcept>
+#include <sstream>
 #include <mutex>
 #include <atomic>
 
@@ -22,22 +23,51 @@
 #include "tools.hpp"
 #include "mem_counter.hpp"
 #include "mem_locator.hpp"
+#include "mem_signal.hpp"
 
+// Locators are set by id (segment_id) from one or many generator threads, in any order. They
+// are published to planners in id order, write_pos only advances over consecutive ready ids.
+// Planners could take locators while they are generated, they wait on signal (notified on
+// publish and completion).
 class MemLocators {
 public:
     std::atomic<size_t> write_pos{0};
     std::atomic<size_t> read_pos{0};
     std::atomic<bool> completed{false};
     MemLocator locators[MAX_LOCATORS];
+    std::atomic<bool> ready[MAX_LOCATORS];
+    MemSignal signal;
     MemLocators() {
+        for (size_t pos = 0; pos < MAX_LOCATORS; ++pos) {
+            ready[pos].store(false, std::memory_order_relaxed);
+        }
     }
-    void push_locator(uint32_t thread_index, uint32_t offset, uint32_t cpos, uint32_t skip) {
-        size_t pos = write_pos.load(std::memory_order_relaxed);
-        locators[pos].thread_index = thread_index;
-        locators[pos].offset = offset;
-        locators[pos].cpos = cpos;
-        locators[pos].skip = skip;
-        write_pos.store(pos + 1, std::memory_order_relaxed);
+    void push_locator(uint32_t entry, uint32_t cpos, uint32_t skip) {
+        set_locator(write_pos.load(std::memory_order_relaxed), entry, cpos, skip);
+    }
+    // ready flags and write_pos use seq_cst, a setter that stops before its id is published
+    // always is seen by the setter of the id that blocks it.
+    void set_locator(size_t segment_id, uint32_t entry, uint32_t cpos, uint32_t skip) {
+        if (segment_id >= MAX_LOCATORS) {
+            std::ostringstream msg;
+            msg << "ERROR: MemLocators::set_locator segment_id " << segment_id << " out of range (" << MAX_LOCATORS << ")";
+            throw std::runtime_error(msg.str());
+        }
+        locators[segment_id].entry = entry;
+        locators[segment_id].cpos = cpos;
+        locators[segment_id].skip = skip;
+        ready[segment_id].store(true);
+        size_t pos = write_pos.load();
+        bool published = false;
+        while (pos < MAX_LOCATORS && ready[pos].load()) {
+            if (write_pos.compare_exchange_weak(pos, pos + 1)) {
+                ++pos;
+                published = true;
+            }
+        }
+        if (published) {
+            signal.notify();
+        }
     }
     MemLocator *get_locator(uint32_t &segment_id) {
         size_t current_read = read_pos.load(std::memory_order_relaxed);
@@ -57,8 +87,32 @@ public:
         segment_id = current_read;
         return item;
     }
+    // waits until a locator is published (returns it) or all were taken after completed
+    MemLocator *get_next_locator(uint32_t &segment_id, MemWaitStats *wait_stats = nullptr) {
+        while (true) {
+            // completed before take, all locators were published if it's set
+            const bool done = is_completed();
+            MemLocator *item = get_locator(segment_id);
+            if (item != nullptr) return item;
+            if (done) return nullptr;
+            signal.wait([this]() {
+                return read_pos.load(std::memory_order_acquire) < write_pos.load(std::memory_order_acquire) ||
+                       completed.load(std::memory_order_acquire);
+            }, wait_stats);
+        }
+    }
     void set_completed() {
         completed.store(true, std::memory_order_release);
+        signal.notify();
+    }
+    // rewind queue, no planner must be reading it
+    void reset() {
+        for (size_t pos = 0; pos < MAX_LOCATORS; ++pos) {
+            ready[pos].store(false, std::memory_order_relaxed);
+        }
+        write_pos.store(0, std::memory_order_relaxed);
+        read_pos.store(0, std::memory_order_relaxed);
+        completed.store(false, std::memory_order_release);
     }
     bool is_completed() {
         return completed.load(std::memory_order_acquire);
@@ -0,0 +1,74 @@
+#ifndef __MEM_OCCUPANCY_HPP__
+#define __MEM_OCCUPANCY_HPP__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include "mem_types.hpp"
+#include "mem_config.hpp"
+#include "mem_partition.hpp"
+#include "mem_counter.hpp"
+#include "tools.hpp"
+
+// Offsets used by any counter, one bit by offset (OR of counter occupancy bitmaps), built by
+// row blocks after count phase; blocks are disjoint, so subranges of blocks could be built
+// concurrently. Address index jumps between used offsets 64 at time with tzcnt instead of
+// reading address tables of all counters on each offset.
+class MemOccupancy {
+private:
+    const uint32_t words_size;
+    uint64_t *words;
+    std::vector<uint8_t> written;               // blocks written by last build
+public:
+    MemOccupancy(const MemPartitionLayout &layout) : words_size((layout.table_size + 63) / 64), written(layout.table_size >> MEM_ROW_BLOCK_BITS, 0) {
+        words = (uint64_t *)lazy_alloc(words_size * sizeof(uint64_t));
+    }
+    ~MemOccupancy() {
+        lazy_free(words, words_size * sizeof(uint64_t));
+    }
+    // combines bitmaps of block of all counters (completed), returns offsets used by each one
+    // (sum of popcounts, entries of block)
+    uint32_t build_block(uint32_t block, const std::vector<MemCounter *> &workers) {
+        const uint32_t block_words = MEM_ROW_BLOCK_SIZE / 64;
+        uint64_t *block_data = words + (uint64_t)block * block_words;
+        uint32_t count = 0;
+        const uint64_t *counter_words = workers[0]->get_occupancy() + (uint64_t)block * block_words;
+        for (uint32_t word = 0; word < block_words; ++word) {
+            block_data[word] = counter_words[word];
+            count += __builtin_popcountll(counter_words[word]);
+        }
+        for (uint32_t i = 1; i < workers.size(); ++i) {
+            counter_words = workers[i]->get_occupancy() + (uint64_t)block * block_words;
+            for (uint32_t word = 0; word < block_words; ++word) {
+                block_data[word] |= counter_words[word];
+                count += __builtin_popcountll(counter_words[word]);
+            }
+        }
+        written[block] = 1;
+        return count;
+    }
+    // block without used offsets, cleared if a previous build wrote it
+    void clear_block(uint32_t block) {
+        if (!written[block]) return;
+        const uint32_t block_words = MEM_ROW_BLOCK_SIZE / 64;
+        memset(words + (uint64_t)block * block_words, 0, block_words * sizeof(uint64_t));
+        written[block] = 0;
+    }
+    // first used offset from offset to last, last + 1 if none
+    inline uint32_t next(uint32_t offset, uint32_t last) const {
+        if (offset > last) return offset;
+        uint32_t index = offset >> 6;
+        const uint32_t last_index = last >> 6;
+        uint64_t word = words[index] & (~0ULL << (offset & 63));
+        while (word == 0) {
+            if (++index > last_index) return last + 1;
+            word = words[index];
+        }
+        return std::min((index << 6) + (uint32_t)__builtin_ctzll(word), last + 1);
+    }
+};
+
+#endif
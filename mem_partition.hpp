@@ -0,0 +1,71 @@
+#ifndef __MEM_PARTITION_HPP__
+#define __MEM_PARTITION_HPP__
+
+#include <stdint.h>
+#include <stdexcept>
+#include <sstream>
+
+#include "mem_config.hpp"
+
+// Address interleave between counters. Aligned addresses are split on bits 3..(3 + bits - 1)
+// (lane), each partition is counted on its own MemCounter. Page layout (64MB pages) doesn't
+// change, only the number of offsets by page, so any partition count produces same plans.
+//
+// Partition function: MEM_PARTITION_LANE uses lane as partition, MEM_PARTITION_XOR_FOLD xors
+// lane with a fold of upper bits (block = addr >> addr_low_bits), so strided accesses are
+// spread between counters. Fold is constant inside a block, a block is still a permutation of
+// lanes and offset of an address doesn't depend on function. Planners get counter of a lane
+// with lane ^ fold_of(addr).
+struct MemPartitionLayout {
+    uint32_t bits;
+    uint32_t partitions;
+    uint32_t function;
+    uint32_t addr_mask;       // address bits that select partition
+    uint32_t addr_low_bits;   // address bits below offset
+    uint32_t page_bits;       // offset bits inside a page
+    uint32_t page_size;       // offsets by page
+    uint32_t relative_offset_mask;
+    uint32_t table_size;      // offsets of address table
+
+    MemPartitionLayout(uint32_t partitions = MEM_PARTITIONS, uint32_t function = MEM_PARTITION_FUNCTION)
+    : partitions(partitions), function(function) {
+        bits = 0;
+        while ((1U << bits) < partitions) ++bits;
+        if ((1U << bits) != partitions || bits < MIN_PARTITION_BITS || bits > MAX_PARTITION_BITS) {
+            std::ostringstream msg;
+            msg << "ERROR: MemPartitionLayout invalid partitions " << partitions << " (power of 2 from "
+                << (1 << MIN_PARTITION_BITS) << " to " << MAX_PARTITIONS << ")";
+            throw std::runtime_error(msg.str());
+        }
+        if (function != MEM_PARTITION_LANE && function != MEM_PARTITION_XOR_FOLD) {
+            std::ostringstream msg;
+            msg << "ERROR: MemPartitionLayout invalid partition function " << function;
+            throw std::runtime_error(msg.str());
+        }
+        addr_mask = (partitions - 1) * 8;
+        addr_low_bits = bits + 3;
+        page_bits = 23 - bits;
+        page_size = 1 << page_bits;
+        relative_offset_mask = page_size - 1;
+        table_size = page_size * MAX_PAGES;
+    }
+    inline uint32_t fold_of(uint32_t addr) const {
+        if (function == MEM_PARTITION_LANE) {
+            return 0;
+        }
+        const uint32_t block = addr >> addr_low_bits;
+        uint32_t fold = 0;
+        for (uint32_t shift = 0; shift < 32 - addr_low_bits; shift += bits) {
+            fold ^= block >> shift;
+        }
+        return fold & (partitions - 1);
+    }
+    inline uint32_t partition_of(uint32_t addr) const {
+        return ((addr & addr_mask) >> 3) ^ fold_of(addr);
+    }
+    const char *get_function_name() const {
+        return function == MEM_PARTITION_XOR_FOLD ? "xor fold" : "lane";
+    }
+};
+
+#endif
@@ -11,6 +11,7 @@
 #include <sys/time.h>
 #include <cstdint>
 #include <vector>
+#include <algorithm>
 #include <map>
 #include <unordered_map>
 #include <stdexcept>
@@ -20,12 +21,19 @@
 #include "mem_types.hpp"
 #include "mem_config.hpp"
 #include "tools.hpp"
+#include "mem_task_pool.hpp"
 #include "mem_counter.hpp"
 #include "mem_segment.hpp"
 #include "mem_check_point.hpp"
 #include "mem_locators.hpp"
 #include "mem_locator.hpp"
 #include "mem_segments.hpp"
+#include "mem_addr_index.hpp"
+
+// segments are located by rows of index entries, counts of address table
+#ifndef USE_ADDR_COUNT_TABLE
+#error "MemPlanner requires USE_ADDR_COUNT_TABLE"
+#endif
 
 #ifdef MEM_PLANNER_STATS
 struct SegmentStats {
@@ -50,10 +58,6 @@ private:
     uint32_t current_chunk;
     uint32_t last_addr;
     uint32_t locators_done;
-    #ifndef MEM_CHECK_POINT_MAP
-    uint32_t *chunk_table;
-    uint32_t limit_pos;
-    #endif
     #ifdef SEGMENT_STATS
     uint32_t max_chunks;
     uint32_t large_segments;
@@ -67,16 +71,19 @@ private:
     // std::vector<MemSegment *> segments;
     #ifdef MEM_PLANNER_STATS
     uint64_t locators_times[8];
+    uint64_t locators_init;
     uint32_t locators_time_count;
     SegmentStats segment_stats[MAX_SEGMENTS];
     #endif
     uint64_t elapsed;
-    MemSegmentHashTable *hash_table;
+    uint32_t locators_subranges;                // 0 = planner didn't generate locators
+    std::atomic<uint64_t> locators_first_us;
+    std::atomic<uint64_t> locators_last_us;
+    MemSegmentArena arena;                      // segments of planner (run)
 
 public:
     MemPlanner(uint32_t id, uint32_t rows, uint32_t from_addr, uint32_t mb_size)
     :id(id),rows(rows) {
-        hash_table = new MemSegmentHashTable(MAX_CHUNKS);   // 2^18 * 2^18 = 2^36   // 2^14 * 2^18 = 2^32
         rows_available = rows;
         reference_addr_chunk = NO_CHUNK_ID;
         reference_addr = 0;
@@ -98,122 +105,99 @@ public:
             msg << "MemPlanner::constructor: from_addr " << std::hex << from_addr << " not aligned to page " << std::dec << from_page;
             throw std::runtime_error(msg.str());
         }
-        #ifndef MEM_CHECK_POINT_MAP
-        chunk_table = (uint32_t *)malloc(MAX_CHUNKS * sizeof(uint32_t));
-        memset(chunk_table, 0, MAX_CHUNKS * sizeof(uint32_t));
-        limit_pos = 0x00010000;
-        #endif
         #ifdef SEGMENT_STATS
         max_chunks = 0;
         tot_chunks = 0;
         large_segments = 0;
         #endif
+        elapsed = 0;
+        locators_subranges = 0;
+        locators_first_us.store(0, std::memory_order_relaxed);
+        locators_last_us.store(0, std::memory_order_relaxed);
     }
     ~MemPlanner() {
     }
-    const MemLocator *get_next_locator(MemLocators &locators, uint32_t &segment_id, uint32_t us_timeout = 10) {
-        const MemLocator *plocator = locators.get_locator(segment_id);
-        bool completed = false;
-        while (plocator == nullptr) {
-            if (completed && locators.is_completed()) {
-                return nullptr;
-            }
-            plocator = locators.get_locator(segment_id);
-            if (plocator != nullptr) {
-                return plocator;
-            }
-            completed = true;
-            usleep(us_timeout);
-            continue;
-        }
-        return plocator;
+    // prepares planner for a new trace, segments of previous trace are released with arena
+    void reset() {
+        current_segment = nullptr;
+        arena.reset();
+        rows_available = rows;
+        reference_addr_chunk = NO_CHUNK_ID;
+        reference_addr = 0;
+        reference_skip = 0;
+        locators_done = 0;
+        current_chunk = NO_CHUNK_ID;
+        #ifdef MEM_PLANNER_STATS
+        locators_time_count = 0;
+        #endif
+        #ifdef DIRECT_MEM_LOCATOR
+        locators_count = 0;
+        #endif
+        #ifdef SEGMENT_STATS
+        max_chunks = 0;
+        tot_chunks = 0;
+        large_segments = 0;
+        #endif
+        elapsed = 0;
     }
-
-    void execute_from_locators(const std::vector<MemCounter *> &workers, MemLocators &locators, MemSegments &segments) {
+    // planners take next locator (waiting while they are generated) until none is left
+    void execute_from_locators(const MemAddrIndex &index, MemLocators &locators, MemSegments &segments) {
         uint64_t init = get_usec();
         const MemLocator *locator;
         uint32_t segment_id = 0;
-        while (true) {
-            if ((locator = get_next_locator(locators, segment_id)) == nullptr) {
-                break;
-            }
-            // printf("EXECUTE_FROM_LOCATOR segment %d thread_index %d offset %d (0x%08X) cpos %d chunk %d skip %d\n", 
-            //     segment_id, locator->thread_index, locator->offset, 
-            //     MemCounter::offset_to_addr(locator->offset, locator->thread_index), 
-            //     locator->cpos, workers[locator->thread_index]->get_pos_value(locator->cpos), locator->skip);
-            execute_from_locator(workers, segment_id, locator);
-            // current_segment->close();
+        while ((locator = locators.get_next_locator(segment_id)) != nullptr) {
+            execute_from_locator(index, segment_id, locator);
+            current_segment->close();
             segments.set(segment_id, current_segment);
             // segments.emplace_back(current_segment);
             current_segment = nullptr;
         }
         elapsed = get_usec() - init;
     }
-    void execute_from_locator(const std::vector<MemCounter *> &workers, uint32_t segment_id, const MemLocator *locator) {
-        uint32_t addr = 0;
-
+    // segment starts on entry of locator (skipping rows of its chunk on cpos) and follows index
+    // until segment is full or last entry of planner pages
+    void execute_from_locator(const MemAddrIndex &index, uint32_t segment_id, const MemLocator *locator) {
         ++locators_done;
         #ifdef MEM_PLANNER_STATS
         uint32_t addr_count = 0;
         uint32_t offset_count = 0;
+        uint32_t first_segment_addr = index.get_entry(locator->entry).addr;
+        uint32_t last_segment_addr = first_segment_addr;
+        const uint32_t addr_low_bits = index.get_layout().addr_low_bits;
         #endif
         uint32_t skip = locator->skip;
-        uint32_t offset = locator->offset;
-        uint32_t page = MemCounter::offset_to_page(offset);
-        uint32_t max_offset = get_max_offset(workers, page);
-        uint32_t thread_index = locator->thread_index;
         uint32_t cpos = locator->cpos;
-        bool first_pos = true;
-        #ifdef MEM_PLANNER_STATS
-        uint32_t first_segment_addr = MemCounter::offset_to_addr(offset, thread_index);
-        uint32_t last_segment_addr = first_segment_addr;
-        #endif
-        for (;page < to_page; ++page, thread_index = 0, get_offset_limits(workers, page, offset, max_offset)) {
-            // printf("offset:0x%08X page:%d addr:0x%08X thread_index:%d max_offset:0x%08X\n", offset, page, addr, thread_index, max_offset);
-            for (;offset <= max_offset; ++offset, thread_index = 0) {
-                addr = MemCounter::offset_to_addr(offset, thread_index);
-                #ifdef MEM_PLANNER_STATS
+        const uint32_t to_entry = index.get_page_entry(to_page);
+        for (uint32_t entry_pos = locator->entry; entry_pos < to_entry; ++entry_pos) {
+            const MemAddrEntry &entry = index.get_entry(entry_pos);
+            const MemCounter *worker = index.get_counter(entry);
+            const uint32_t addr = entry.addr;
+            #ifdef MEM_PLANNER_STATS
+            if (addr_count == 0 || (addr >> addr_low_bits) != (last_segment_addr >> addr_low_bits)) {
                 ++offset_count;
-                #endif
-                for (;thread_index < MAX_THREADS; ++thread_index, addr += 8, first_pos = false) {
-                    uint32_t pos = workers[thread_index]->get_addr_table(offset);
-                    if (pos == 0) {
-                        if (first_pos) printf("************ ERROR SEGMENT %d thread_index %d offset %d addr 0x%08X\n", segment_id, thread_index, offset, addr);
-                        continue;
-                    }
+            }
+            last_segment_addr = addr;
+            ++addr_count;
+            #endif
+            if (segment_id == 0 || entry_pos != locator->entry) {
+                skip = 0;
+                cpos = worker->get_initial_pos(entry.pos);
+            }
+            while (cpos != 0) {
+                uint32_t chunk_id = worker->get_pos_chunk(cpos);
+                uint32_t count = worker->get_pos_count(cpos);
+                if (skip > count) {
+                    printf("*********** ERROR Counter %d segment_id %d skip %d > count %d 0x%08X\n", entry.counter, segment_id, skip, count, addr);
+                }
+                if (add_chunk(chunk_id, addr, count - skip, skip) == false) {
                     #ifdef MEM_PLANNER_STATS
-                    last_segment_addr = addr;
-                    ++addr_count;
+                    update_segment_stats(addr_count, offset_count, first_segment_addr, last_segment_addr);
                     #endif
-                    if (segment_id == 0 || first_pos == false) {          
-                        skip = 0;      
-                        cpos = workers[thread_index]->get_initial_pos(pos); 
-                    } else {
-                        // printf("FIRST_POS segment %d thread_index %d offset %d (0x%08X/0x%08X) cpos %d chunk %d skip %d\n", 
-                        //     segment_id, thread_index, offset, MemCounter::offset_to_addr(offset, thread_index), 
-                        //     addr, cpos, workers[thread_index]->get_pos_value(cpos), skip);
-                    }
-                    while (cpos != 0) {
-                        uint32_t chunk_id = workers[thread_index]->get_pos_value(cpos);
-                        uint32_t count = workers[thread_index]->get_pos_value(cpos+1);
-                        // if ((segment_id == 59) || skip > count) {
-                        //     printf("###3 Thread %d segment_id %d execute_from_locator addr 0x%08X/0x%08X count %d first_pos %d skip %d cpos %d chunk_id %d\n",
-                        //            thread_index, segment_id, MemCounter::offset_to_addr(offset, thread_index), addr, count, first_pos, skip, cpos, chunk_id);
-                        // }
-                        if (skip > count) {
-                            printf("*********** ERROR Thread %d segment_id %d skip %d > count %d 0x%08X/0x%08X first_pos %d\n", thread_index, segment_id, skip, count, MemCounter::offset_to_addr(offset, thread_index), addr, first_pos);
-                        }
-                        if (add_chunk(chunk_id, addr, count - skip, skip) == false) {
-                            #ifdef MEM_PLANNER_STATS
-                            update_segment_stats(addr_count, offset_count, first_segment_addr, last_segment_addr);
-                            #endif
-                            return;
-                        }
-                        skip = 0;
-                        if (cpos == pos) break;
-                        cpos = workers[thread_index]->get_next_pos(cpos+1);
-                    }
+                    return;
                 }
+                skip = 0;
+                if (cpos == entry.pos) break;
+                cpos = worker->get_next_pos(cpos);
             }
         }
         #ifdef MEM_PLANNER_STATS
@@ -231,88 +215,127 @@ public:
         segment_stats[index].chunks = current_segment->size();
     }
     #endif
-    void generate_locators(const std::vector<MemCounter *> &workers, MemLocators &locators) {
+    // Segment boundaries (each rows) are located with rows by offset block of counters: prefix
+    // sum of blocks of planner pages gives block of each boundary (binary search), only entries
+    // of that block are walked. Same locators than walking all addresses.
+    //
+    // Blocks are split in subranges, each one sums its rows in parallel, an exclusive scan of
+    // subrange totals gives rows before each subrange, and each subrange sets locators of its
+    // boundaries concurrently. Locators are set by segment_id, so output is same than serial.
+    void generate_locators(const MemAddrIndex &index, MemLocators &locators, uint32_t threads = MEM_LOCATOR_THREADS) {
         uint64_t init = get_usec();
-        rows_available = rows;
-        uint32_t count;
-        uint32_t offset, max_offset;
-        bool inserted_first_locator = false;
-        for (uint32_t page = from_page; page < to_page; ++page) {
-            // printf("page:0x%08X\n", page);
-            get_offset_limits(workers, page, offset, max_offset);
-            for (;offset <= max_offset; ++offset) {
-                for (uint32_t thread_index = 0; thread_index < MAX_THREADS; ++thread_index) {
-                    uint32_t pos = workers[thread_index]->get_addr_table(offset);
-                    if (pos == 0) continue;
-                    if (inserted_first_locator == false) {
-                        inserted_first_locator = true;
-                        locators.push_locator(thread_index, offset, pos, 0);
-                    }
-                    // uint32_t addr_count = workers[thread_index]->get_count_table(offset);
-                    // if (rows_available > addr_count) {
-                    //     printf("CHUNK_CONTENT %ld * 0x%08X (%d) %d\n", locators.size() - 1, MemCounter::offset_to_addr(offset, thread_index), rows_available, addr_count);
-                    //     rows_available -= addr_count;
-                    //     continue;
-                    // }
-                    uint32_t cpos = workers[thread_index]->get_initial_pos(pos);
-                    while (true) {
-                        uint32_t chunk_id = workers[thread_index]->get_pos_value(cpos);
-                        count = workers[thread_index]->get_pos_value(cpos+1);
-                        // printf("CHUNK_CONTENT %ld %d 0x%08X (%d) %d \n", locators.size() - 1, chunk_id, MemCounter::offset_to_addr(offset, thread_index), rows_available, count);
-                        uint32_t initial_count = count;
-                        while (count > 0) {
-                            if (rows_available > count) {
-                                rows_available -= count;
-                                break;
-                            } else if (rows_available <= count) {
-                                // when rows_available == count, we need to pass by offset,cpos to get last value
-                                #ifdef MEM_PLANNER_STATS
-                                if (locators_time_count < 8) {
-                                    locators_times[locators_time_count++] = get_usec() - init;
-                                }
-                                #endif
-                                count -= rows_available;
-                                uint32_t skip = initial_count - count;
-                                // printf("PUSH LOCATOR segment %ld thread_index %d offset %d (0x%08X) cpos %d %d skip %d rows_available %d count %d\n", 
-                                //      locators.size() - 1, thread_index, offset, MemCounter::offset_to_addr(offset, thread_index), cpos, workers[thread_index]->get_pos_value(cpos), skip, rows_available, count);
-                                locators.push_locator(thread_index, offset, cpos, skip);
-                                rows_available = rows;
-                                // printf("CHUNK_CONTENT %ld %d * 0x%08X (%d) %d \n", locators.size() - 1, chunk_id, MemCounter::offset_to_addr(offset, thread_index), rows_available, count);
-                            }
-                        }
-                        if (pos == cpos) break;
-                        cpos = workers[thread_index]->get_next_pos(cpos+1);
-                    }
-                }
+        #ifdef MEM_PLANNER_STATS
+        locators_init = init;
+        #endif
+        const uint32_t page_size = index.get_layout().page_size;
+        const uint32_t from_block = (from_page * page_size) >> MEM_ROW_BLOCK_BITS;
+        const uint32_t to_block = (to_page * page_size) >> MEM_ROW_BLOCK_BITS;
+        const uint32_t blocks = to_block - from_block;
+        // serial when there is no hardware to run subranges or too few blocks
+        const uint32_t subranges = std::max(1U, std::min(parallel_threads(threads), blocks / MEM_LOCATOR_MIN_BLOCKS));
+        locators_subranges = subranges;
+        locators_first_us.store(0, std::memory_order_relaxed);
+        locators_last_us.store(0, std::memory_order_relaxed);
+
+        // rows before each block (local of its subrange until scan), and rows of each subrange
+        std::vector<uint64_t> block_from(blocks);
+        std::vector<uint64_t> subrange_from(subranges + 1);
+        auto get_subrange = [from_block, blocks, subranges](uint32_t index, uint32_t &from, uint32_t &to) {
+            from = from_block + (uint64_t)blocks * index / subranges;
+            to = from_block + (uint64_t)blocks * (index + 1) / subranges;
+        };
+        run_parallel(subranges, [&](uint32_t subrange) {
+            uint32_t from, to;
+            get_subrange(subrange, from, to);
+            uint64_t total = 0;
+            for (uint32_t block = from; block < to; ++block) {
+                block_from[block - from_block] = total;
+                total += index.get_block_rows(block);
             }
+            subrange_from[subrange] = total;
+        });
+        uint64_t total = 0;
+        for (uint32_t subrange = 0; subrange < subranges; ++subrange) {
+            const uint64_t subrange_rows = subrange_from[subrange];
+            subrange_from[subrange] = total;
+            total += subrange_rows;
+        }
+        subrange_from[subranges] = total;
+        // segment k starts on row k * rows, check bound before subranges set locators
+        if (total / rows >= MAX_LOCATORS) {
+            std::ostringstream msg;
+            msg << "ERROR: MemPlanner::generate_locators " << (total / rows + 1) << " segments out of range (" << MAX_LOCATORS << ")";
+            throw std::runtime_error(msg.str());
         }
+
+        // first locator on first address, after that one each rows, segment k on row k * rows
+        run_parallel(subranges, [&](uint32_t subrange) {
+            uint32_t from, to;
+            get_subrange(subrange, from, to);
+            const uint64_t rows_before = subrange_from[subrange];
+            const uint64_t rows_end = subrange_from[subrange + 1];
+            for (uint32_t block = from; block < to; ++block) {
+                block_from[block - from_block] += rows_before;
+            }
+            uint32_t segment_id = rows_before == 0 ? 0 : rows_before / rows + 1;
+            uint64_t target = segment_id == 0 ? 1 : (uint64_t)segment_id * rows;
+            const auto first = block_from.begin() + (from - from_block);
+            const auto last = block_from.begin() + (to - from_block);
+            while (target <= rows_end) {
+                uint32_t block_index = (std::upper_bound(first, last, target - 1) - block_from.begin()) - 1;
+                target = locate_rows(index, locators, from_block + block_index, block_from[block_index], target, segment_id, init);
+            }
+        });
         locators.set_completed();
         elapsed = get_usec() - init;
     }
-    void get_offset_limits(const std::vector<MemCounter *> &workers, uint32_t page, uint32_t &first_offset, uint32_t &last_offset) {
-        first_offset = workers[0]->first_offset[page];
-        last_offset = workers[0]->last_offset[page];
-        for (int i = 1; i < MAX_THREADS; ++i) {
-            first_offset = std::min(first_offset, workers[i]->first_offset[page]);
-            last_offset = std::max(last_offset, workers[i]->last_offset[page]);
+    // walks entries of block setting locators of all targets inside it, returns next target
+    uint64_t locate_rows(const MemAddrIndex &index, MemLocators &locators, uint32_t block, uint64_t rows_done, uint64_t target, uint32_t &segment_id, uint64_t init) {
+        const uint32_t to_entry = index.get_block_entry(block + 1);
+        for (uint32_t entry_pos = index.get_block_entry(block); entry_pos < to_entry; ++entry_pos) {
+            const MemAddrEntry &entry = index.get_entry(entry_pos);
+            if (rows_done + entry.count < target) {
+                rows_done += entry.count;
+                continue;
+            }
+            const MemCounter *worker = index.get_counter(entry);
+            uint32_t cpos = worker->get_initial_pos(entry.pos);
+            while (true) {
+                uint32_t count = worker->get_pos_count(cpos);
+                while (rows_done + count >= target) {
+                    #ifdef MEM_PLANNER_STATS
+                    if (segment_id > 0 && locators_time_count < 8) {
+                        locators_times[locators_time_count++] = get_usec() - locators_init;
+                    }
+                    #endif
+                    if (segment_id == 0) {
+                        locators.set_locator(segment_id, entry_pos, entry.pos, 0);
+                        target = rows;
+                    } else {
+                        locators.set_locator(segment_id, entry_pos, cpos, target - rows_done);
+                        target += rows;
+                    }
+                    set_locator_time(segment_id++, get_usec() - init);
+                }
+                rows_done += count;
+                if (entry.pos == cpos) break;
+                cpos = worker->get_next_pos(cpos);
+            }
         }
+        return target;
     }
-    uint32_t get_max_offset(const std::vector<MemCounter *> &workers, uint32_t page) {
-        uint32_t last_offset = workers[0]->last_offset[page];
-        for (int i = 1; i < MAX_THREADS; ++i) {
-            last_offset = std::max(last_offset, workers[i]->last_offset[page]);
+    void set_locator_time(uint32_t segment_id, uint64_t us) {
+        if (segment_id == 0) {
+            locators_first_us.store(us, std::memory_order_relaxed);
         }
-        return last_offset;
+        uint64_t current = locators_last_us.load(std::memory_order_relaxed);
+        while (current < us && !locators_last_us.compare_exchange_weak(current, us, std::memory_order_relaxed));
     }
     bool add_chunk(uint32_t chunk_id, uint32_t addr, uint32_t count, uint32_t skip = 0) {
         if (current_segment == nullptr) {
             // include first chunk
             uint32_t consumed = std::min(count, rows);
-            #ifdef MEM_CHECK_POINT_MAP
-            current_segment = new MemSegment(chunk_id, addr, skip, consumed);
-            #else
-            current_segment = new MemSegment(hash_table, chunk_id, addr, skip, consumed);
-            #endif
+            current_segment = arena.create<MemSegment>(&arena, chunk_id, addr, skip, consumed);
             rows_available = rows - consumed;
             return (rows_available != 0);
         }
@@ -327,14 +350,19 @@ public:
     }
 
     void current_segment_add(uint32_t chunk_id, uint32_t addr, uint32_t count) {
-        #ifdef MEM_CHECK_POINT_MAP
         current_segment->add_or_update(chunk_id, addr, 0, count);
-        #else
-        current_segment->add_or_update(hash_table, chunk_id, addr, 0, count);
-        #endif
+    }
+    // bytes served and blocks allocated by arena on this run
+    void add_arena_stats(uint64_t &bytes, uint32_t &mallocs) const {
+        bytes += arena.get_bytes_served();
+        mallocs += arena.get_mallocs();
     }
     void stats() {
         printf("PLANNER|I: %2d|D: %4d|%7.2f ms\n", id, locators_done, elapsed / 1000.0);
+        if (locators_subranges > 0) {
+            printf("LOCATORS|I: %2d|K: %2d|first: %7.3f ms|last: %7.3f ms\n", id, locators_subranges,
+                locators_first_us.load(std::memory_order_relaxed) / 1000.0, locators_last_us.load(std::memory_order_relaxed) / 1000.0);
+        }
         #ifdef MEM_PLANNER_STATS
         for (uint32_t index = 0; index < locators_time_count; ++index) {
             printf("MemPlanner::stats: locators_time[%d]: %lu\n", index, locators_times[index]);
@@ -0,0 +1,334 @@
+#ifndef __MEM_RANGE_COUNTER_HPP__
+#define __MEM_RANGE_COUNTER_HPP__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <sstream>
+
+#include "mem_types.hpp"
+#include "mem_config.hpp"
+#include "mem_context.hpp"
+#include "mem_partition.hpp"
+#include "mem_region_map.hpp"
+#include "mem_trace_codec.hpp"
+#include "mem_counter.hpp"
+#include "mem_counter_metrics.hpp"
+#include "tools.hpp"
+
+struct MemRangeEntry {
+    uint32_t offset;
+    uint32_t chunk_id;
+    uint32_t count;
+};
+
+// Result of a range of MEM_COUNT_RANGE_CHUNKS chunks, for each partition one entry by address
+// and chunk, sorted by (offset, chunk_id).
+struct MemRange {
+    std::vector<MemRangeEntry> entries[MAX_PARTITIONS];
+    uint32_t unmapped_count[MAX_PARTITIONS];
+    uint32_t first_unmapped_addr[MAX_PARTITIONS];
+    uint64_t records[MAX_PARTITIONS];
+    void clear() {
+        for (uint32_t partition = 0; partition < MAX_PARTITIONS; ++partition) {
+            entries[partition].clear();
+            unmapped_count[partition] = 0;
+            first_unmapped_addr[partition] = 0;
+            records[partition] = 0;
+        }
+    }
+};
+
+// Per worker aggregation of a chunk, open addressing on key = offset << bits | partition.
+// Slots are tagged with a generation instead of cleared between chunks (and runs).
+class MemRangeAggregator {
+private:
+    uint32_t *keys;
+    uint32_t *counts;
+    uint32_t *tags;
+    std::vector<uint32_t> used;
+    uint32_t tag;
+public:
+    MemRangeAggregator() : tag(0) {
+        keys = new uint32_t[MEM_RANGE_HASH_SIZE];
+        counts = new uint32_t[MEM_RANGE_HASH_SIZE];
+        tags = new uint32_t[MEM_RANGE_HASH_SIZE];
+        memset(tags, 0, MEM_RANGE_HASH_SIZE * sizeof(uint32_t));
+        used.reserve(MEM_RANGE_HASH_SIZE / 2);
+        clear();
+    }
+    ~MemRangeAggregator() {
+        delete [] keys;
+        delete [] counts;
+        delete [] tags;
+    }
+    void clear() {
+        used.clear();
+        if (++tag == 0) {
+            memset(tags, 0, MEM_RANGE_HASH_SIZE * sizeof(uint32_t));
+            tag = 1;
+        }
+    }
+    inline void add(uint32_t key, uint32_t count) {
+        uint32_t index = (key * 0x9E3779B1) >> (32 - MEM_RANGE_HASH_BITS);
+        while (tags[index] == tag) {
+            if (keys[index] == key) {
+                counts[index] += count;
+                return;
+            }
+            index = (index + 1) & (MEM_RANGE_HASH_SIZE - 1);
+        }
+        tags[index] = tag;
+        keys[index] = key;
+        counts[index] = count;
+        used.push_back(index);
+    }
+    // half load, caller must flush
+    inline bool full() const {
+        return used.size() >= MEM_RANGE_HASH_SIZE / 2;
+    }
+    void flush(MemRange *range, uint32_t chunk_id, uint32_t bits) {
+        const uint32_t partition_mask = (1 << bits) - 1;
+        for (auto index: used) {
+            range->entries[keys[index] & partition_mask].push_back(MemRangeEntry{keys[index] >> bits, chunk_id, counts[index]});
+        }
+        clear();
+    }
+};
+
+// State of a range worker kept between runs, metrics are its live progress (chunks is next
+// chunk of its range, all chunks when it finished; counters have no progress until merged).
+struct MemRangeWorker {
+    MemRangeAggregator aggregator;
+    MemCounterMetrics metrics;
+    MemWaitStats wait_stats;
+    void clear() {
+        metrics.clear();
+        wait_stats.clear();
+    }
+};
+
+// Alternative count engine. Workers take ranges of consecutive chunks and count each one for all
+// partitions on private structures (MemRange), so work doesn't depend on address distribution.
+// After that, merge builds the slot chains of each partition on its MemCounter adding ranges in
+// chunk order, so planners see same counters than partition engine. Workers (aggregator and
+// metrics) are kept between runs as ranges.
+class MemRangeCounter {
+private:
+    MemContext *context;
+    const MemPartitionLayout layout;
+    const MemRegionMap region_map;
+    MemRange **ranges;
+    const uint32_t max_ranges;
+    std::vector<MemRangeWorker *> workers;
+    std::atomic<uint32_t> merged;               // partitions merged
+    std::atomic<uint32_t> next_range;
+    std::atomic<uint32_t> elapsed_ms;
+    std::atomic<uint32_t> merge_ms;
+public:
+    MemRangeCounter(MemContext *context, const MemPartitionLayout &layout)
+    : context(context), layout(layout), region_map(layout), max_ranges((MAX_CHUNKS + MEM_COUNT_RANGE_CHUNKS - 1) / MEM_COUNT_RANGE_CHUNKS),
+      merged(0), next_range(0), elapsed_ms(0), merge_ms(0) {
+        ranges = new MemRange*[max_ranges];
+        for (uint32_t index = 0; index < max_ranges; ++index) {
+            ranges[index] = nullptr;
+        }
+    }
+    ~MemRangeCounter() {
+        for (uint32_t index = 0; index < max_ranges; ++index) {
+            delete ranges[index];
+        }
+        delete [] ranges;
+        for (auto worker: workers) {
+            delete worker;
+        }
+    }
+    // workers 0..count-1, called before workers run
+    void reserve_workers(uint32_t count) {
+        while (workers.size() < count) {
+            workers.push_back(new MemRangeWorker());
+        }
+    }
+    // ranges are kept (with their capacity) for next trace
+    void reset() {
+        for (uint32_t index = 0; index < max_ranges; ++index) {
+            if (ranges[index] != nullptr) {
+                ranges[index]->clear();
+            }
+        }
+        for (auto worker: workers) {
+            worker->clear();
+        }
+        merged.store(0, std::memory_order_relaxed);
+        next_range.store(0, std::memory_order_relaxed);
+        elapsed_ms.store(0, std::memory_order_relaxed);
+        merge_ms.store(0, std::memory_order_relaxed);
+    }
+    // worker thread, many could run concurrently (each with its own worker, see reserve_workers)
+    void execute(uint32_t worker_id) {
+        uint64_t init = get_usec();
+        MemRangeWorker *worker = workers[worker_id];
+        MemRangeAggregator &aggregator = worker->aggregator;
+        uint64_t records = 0;
+        MemTraceDecoder decoder;
+        std::vector<MemRangeEntry> scratch;
+        uint32_t range_id;
+        bool completed = false;
+        while (!completed && (range_id = next_range.fetch_add(1, std::memory_order_relaxed)) < max_ranges) {
+            if (ranges[range_id] == nullptr) {
+                ranges[range_id] = new MemRange();
+                ranges[range_id]->clear();
+            }
+            MemRange *range = ranges[range_id];
+            const uint32_t from_chunk = range_id * MEM_COUNT_RANGE_CHUNKS;
+            const uint32_t to_chunk = std::min(from_chunk + MEM_COUNT_RANGE_CHUNKS, (uint32_t)MAX_CHUNKS);
+            const MemChunk *chunk;
+            for (uint32_t chunk_id = from_chunk; chunk_id < to_chunk; ++chunk_id) {
+                if ((chunk = context->get_chunk(chunk_id, &worker->wait_stats)) == nullptr) {
+                    completed = true;
+                    break;
+                }
+                const MemCountersBusData *data = chunk->data;
+                uint32_t count = chunk->count;
+                if (chunk->encoded != nullptr) {
+                    data = decoder.decode(chunk->encoded, count);
+                }
+                count_chunk(range, aggregator, chunk_id, data, count);
+                records += count;
+                publish_metrics(worker, chunk_id + 1, records);
+            }
+            for (uint32_t partition = 0; partition < layout.partitions; ++partition) {
+                sort_entries(range->entries[partition], scratch);
+            }
+        }
+        // no ranges left for worker, it isn't behind any chunk
+        publish_metrics(worker, context->size(), records);
+        uint32_t elapsed = (get_usec() - init) / 1000;
+        uint32_t current = elapsed_ms.load(std::memory_order_relaxed);
+        while (current < elapsed && !elapsed_ms.compare_exchange_weak(current, elapsed, std::memory_order_relaxed));
+    }
+    void publish_metrics(MemRangeWorker *worker, uint32_t chunks, uint64_t records) {
+        worker->metrics.chunks.store(chunks, std::memory_order_relaxed);
+        worker->metrics.records.store(records, std::memory_order_relaxed);
+        worker->metrics.parked_us.store(worker->wait_stats.parked_us, std::memory_order_relaxed);
+        worker->metrics.spin_us.store(worker->wait_stats.spin_us, std::memory_order_relaxed);
+    }
+    void count_chunk(MemRange *range, MemRangeAggregator &aggregator, uint32_t chunk_id, const MemCountersBusData *chunk_data, uint32_t chunk_size) {
+        for (uint32_t i = 0; i < chunk_size; ++i) {
+            const uint8_t bytes = chunk_data[i].flags & 0xFF;
+            const uint32_t addr = chunk_data[i].addr;
+            if (bytes == 8 && (addr & 0x07) == 0) {
+                add(range, aggregator, addr, 1);
+            } else {
+                const uint32_t aligned_addr = addr & 0xFFFFFFF8;
+                const uint32_t ops = 1 + (chunk_data[i].flags >> 16);
+                add(range, aggregator, aligned_addr, ops);
+                if ((bytes + (addr & 0x07)) > 8) {
+                    add(range, aggregator, aligned_addr + 8, ops);
+                }
+            }
+            if (aggregator.full()) {
+                aggregator.flush(range, chunk_id, layout.bits);
+            }
+        }
+        aggregator.flush(range, chunk_id, layout.bits);
+    }
+    inline void add(MemRange *range, MemRangeAggregator &aggregator, uint32_t addr, uint32_t count) {
+        uint32_t offset;
+        const uint32_t partition = layout.partition_of(addr);
+        ++range->records[partition];
+        if (!region_map.try_addr_to_offset(addr, offset)) {
+            if (range->unmapped_count[partition]++ == 0) {
+                range->first_unmapped_addr[partition] = addr;
+            }
+            return;
+        }
+        aggregator.add(offset << layout.bits | partition, count);
+    }
+    // stable LSD radix sort by offset, entries were added in chunk order so result is sorted by
+    // (offset, chunk_id). A chunk flushed more than once could repeat keys, they are coalesced.
+    static void sort_entries(std::vector<MemRangeEntry> &entries, std::vector<MemRangeEntry> &scratch) {
+        if (entries.empty()) return;
+        uint32_t max_offset = 0;
+        for (const MemRangeEntry &entry: entries) {
+            max_offset = std::max(max_offset, entry.offset);
+        }
+        scratch.resize(entries.size());
+        const uint32_t buckets = 1 << MEM_RANGE_RADIX_BITS;
+        std::vector<uint32_t> from(buckets);
+        for (uint32_t shift = 0; shift == 0 || (max_offset >> shift) != 0; shift += MEM_RANGE_RADIX_BITS) {
+            std::fill(from.begin(), from.end(), 0);
+            for (const MemRangeEntry &entry: entries) {
+                ++from[(entry.offset >> shift) & (buckets - 1)];
+            }
+            uint32_t total = 0;
+            for (uint32_t bucket = 0; bucket < buckets; ++bucket) {
+                uint32_t count = from[bucket];
+                from[bucket] = total;
+                total += count;
+            }
+            for (const MemRangeEntry &entry: entries) {
+                scratch[from[(entry.offset >> shift) & (buckets - 1)]++] = entry;
+            }
+            entries.swap(scratch);
+        }
+        size_t last = 0;
+        for (size_t index = 1; index < entries.size(); ++index) {
+            if (entries[index].offset == entries[last].offset && entries[index].chunk_id == entries[last].chunk_id) {
+                entries[last].count += entries[index].count;
+            } else {
+                entries[++last] = entries[index];
+            }
+        }
+        entries.resize(last + 1);
+    }
+    // builds counter of one partition, all workers must be finished. Different partitions
+    // could be merged concurrently.
+    void merge(MemCounter *counter) {
+        uint64_t init = get_usec();
+        const uint32_t partition = counter->get_id();
+        const uint32_t ranges_count = get_used_ranges();
+        for (uint32_t range_id = 0; range_id < ranges_count; ++range_id) {
+            const MemRange *range = ranges[range_id];
+            counter->add_unmapped(range->unmapped_count[partition], range->first_unmapped_addr[partition]);
+            counter->add_records(range->records[partition], range->records[partition]);
+            for (const MemRangeEntry &entry: range->entries[partition]) {
+                counter->count_offset(entry.offset, entry.chunk_id, entry.count);
+            }
+        }
+        counter->publish_metrics(context->size());
+        merged.fetch_add(1, std::memory_order_release);
+        uint32_t elapsed = (get_usec() - init) / 1000;
+        counter->set_elapsed_ms(elapsed);
+        uint32_t current = merge_ms.load(std::memory_order_relaxed);
+        while (current < elapsed && !merge_ms.compare_exchange_weak(current, elapsed, std::memory_order_relaxed));
+    }
+    // all ranges with chunks were taken by some worker before any of them found end of trace
+    uint32_t get_used_ranges() const {
+        return (context->size() + MEM_COUNT_RANGE_CHUNKS - 1) / MEM_COUNT_RANGE_CHUNKS;
+    }
+    // counters have metrics when all partitions were merged
+    bool is_merged() const {
+        return merged.load(std::memory_order_acquire) >= layout.partitions;
+    }
+    // live metrics of workers, lag is against chunks available
+    void metrics_to_json(std::ostringstream &out, uint32_t available_chunks) const {
+        for (uint32_t i = 0; i < workers.size(); ++i) {
+            if (i > 0) out << ",";
+            workers[i]->metrics.to_json(out, i, available_chunks);
+        }
+    }
+    uint32_t get_elapsed_ms() const {
+        return elapsed_ms.load(std::memory_order_relaxed);
+    }
+    uint32_t get_merge_ms() const {
+        return merge_ms.load(std::memory_order_relaxed);
+    }
+};
+
+#endif
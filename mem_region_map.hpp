@@ -0,0 +1,129 @@
+#ifndef __MEM_REGION_MAP_HPP__
+#define __MEM_REGION_MAP_HPP__
+
+#include <stdint.h>
+#include <stdexcept>
+#include <sstream>
+
+#include "mem_config.hpp"
+#include "mem_partition.hpp"
+
+// Memory regions counted, each one split in pages of MEM_REGION_PAGE_MB, pages numbered
+// consecutively following this order.
+struct MemRegion {
+    const char *name;
+    uint32_t from_addr;
+    uint32_t mb_size;
+};
+
+#define MEM_REGION_PAGE_BITS 26
+#define MEM_REGION_PAGE_MB (1 << (MEM_REGION_PAGE_BITS - 20))
+
+static const MemRegion mem_regions[] = {
+    {"rom",   0x80000000,  128},
+    {"input", 0x90000000,  128},
+    {"ram",   0xA0000000, 1024},
+};
+
+// Translation of addresses to pages and offsets of address table, built once from a region
+// list. Indexed by top address byte:
+//
+//   page   = lut[addr >> 24].page
+//   offset = (addr >> addr_low_bits) + lut[addr >> 24].bias
+//
+// bias = page * page_size - (page_base >> addr_low_bits), unmapped bytes have page EMPTY_PAGE.
+class MemRegionMap {
+private:
+    struct Entry {
+        uint32_t page;
+        uint32_t bias;
+    };
+    Entry lut[256];
+    uint32_t page_base[MAX_PAGES];
+    uint32_t pages;
+    uint32_t addr_low_bits;
+public:
+    MemRegionMap(const MemPartitionLayout &layout = MemPartitionLayout(), const MemRegion *regions = mem_regions,
+                 uint32_t region_count = sizeof(mem_regions) / sizeof(MemRegion)) : pages(0), addr_low_bits(layout.addr_low_bits) {
+        for (uint32_t index = 0; index < 256; ++index) {
+            lut[index] = Entry{EMPTY_PAGE, 0};
+        }
+        for (uint32_t index = 0; index < region_count; ++index) {
+            const MemRegion &region = regions[index];
+            if ((region.from_addr & ((1 << MEM_REGION_PAGE_BITS) - 1)) != 0 || region.mb_size == 0 ||
+                (region.mb_size % MEM_REGION_PAGE_MB) != 0 ||
+                ((uint64_t)region.from_addr + ((uint64_t)region.mb_size << 20)) > 0x100000000ULL) {
+                std::ostringstream msg;
+                msg << "ERROR: MemRegionMap region " << region.name << " 0x" << std::hex << region.from_addr
+                    << std::dec << " " << region.mb_size << "MB not aligned to " << MEM_REGION_PAGE_MB << "MB pages";
+                throw std::runtime_error(msg.str());
+            }
+            for (uint32_t mb = 0; mb < region.mb_size; mb += MEM_REGION_PAGE_MB) {
+                if (pages >= MAX_PAGES) {
+                    std::ostringstream msg;
+                    msg << "ERROR: MemRegionMap region " << region.name << " exceeds " << MAX_PAGES << " pages";
+                    throw std::runtime_error(msg.str());
+                }
+                const uint32_t base = region.from_addr + (mb << 20);
+                const uint32_t bias = pages * layout.page_size - (base >> addr_low_bits);
+                for (uint32_t top = base >> 24; top < ((base >> 24) + (MEM_REGION_PAGE_MB >> 4)); ++top) {
+                    if (lut[top].page != EMPTY_PAGE) {
+                        std::ostringstream msg;
+                        msg << "ERROR: MemRegionMap region " << region.name << " overlaps at 0x" << std::hex << base;
+                        throw std::runtime_error(msg.str());
+                    }
+                    lut[top] = Entry{pages, bias};
+                }
+                page_base[pages++] = base;
+            }
+        }
+    }
+    // non-throwing translation, returns false if addr isn't on any region
+    inline bool try_addr_to_offset(uint32_t addr, uint32_t &offset) const {
+        const Entry &entry = lut[addr >> 24];
+        offset = (addr >> addr_low_bits) + entry.bias;
+        return entry.page != EMPTY_PAGE;
+    }
+    inline uint32_t try_addr_to_page(uint32_t addr) const {
+        return lut[addr >> 24].page;
+    }
+    uint32_t addr_to_offset(uint32_t addr, uint32_t chunk_id = 0) const {
+        uint32_t offset;
+        if (!try_addr_to_offset(addr, offset)) {
+            std::ostringstream msg;
+            msg << "ERROR: addr_to_offset: 0x" << std::hex << addr << " (" << std::dec << chunk_id << ")";
+            throw std::runtime_error(msg.str());
+        }
+        return offset;
+    }
+    uint32_t addr_to_page(uint32_t addr, uint32_t chunk_id = 0, uint32_t index = 0) const {
+        uint32_t page = lut[addr >> 24].page;
+        if (page == EMPTY_PAGE) {
+            std::ostringstream msg;
+            msg << "ERROR: addr_to_page: 0x" << std::hex << addr << " (" << std::dec << chunk_id << ":" << index << ")";
+            throw std::runtime_error(msg.str());
+        }
+        return page;
+    }
+    inline uint32_t page_to_addr(uint32_t page) const {
+        if (page < pages) {
+            return page_base[page];
+        }
+        if (page == 0xFF) {
+            return 0xFFFFFFFF;
+        }
+        std::ostringstream msg;
+        msg << "ERROR: MemRegionMap page_to_addr page:" << page;
+        throw std::runtime_error(msg.str());
+    }
+    uint32_t size() const {
+        return pages;
+    }
+    // page mapping doesn't depend on partitions, shared by static helpers
+    static const MemRegionMap &get_default() {
+        static const MemRegionMap region_map;
+        return region_map;
+    }
+};
+
+#endif
@@ -1,10 +1,14 @@
 #ifndef __MEM_SEGMENT_HPP__
 #define __MEM_SEGMENT_HPP__
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <vector>
-#include <unordered_map>
+#include <algorithm>
 #include <stdexcept>
 #include "mem_config.hpp"
 #include "mem_check_point.hpp"
+#include "mem_arena.hpp"
 
 #define MEM_SEGMENT_HASH_TABLE_KEY_NOT_FOUND 0xFFFFFFFF
 class MemSegmentHashTable {
@@ -61,154 +65,92 @@ public:
     }
 };
 
-/*
-class MemSegmentFast {
+// Arena of a planner, its segments and their checkpoints. A planner builds one segment at time,
+// its checkpoints are appended on arena tail (dense) and chunk_id -> checkpoint index is kept on a
+// hash table cleared by epoch when segment begins. Segments are valid until planner is reset.
+class MemSegmentArena : public MemArena {
 private:
-    MemSegmentHashTable *hash_table;
-    uint32_t push(uint32_t chunk_id, uint32_t from_addr, uint32_t skip, uint32_t count) {
-        uint32_t index = chunks.size();
-        hash_table->set(chunk_id, index);
-        chunks.emplace_back(chunk_id, from_addr, skip, count);
-        return index;
-    }
+    MemSegmentHashTable hash_table;
 public:
-    std::vector<MemCheckPoint> chunks;
-    MemSegmentFast(MemSegmentHashTable *hash_table): hash_table(hash_table) {
-        chunks.reserve(1024);
+    MemSegmentArena() : hash_table(MAX_CHUNKS) {
     }
-    MemSegmentFast(MemSegmentHashTable *hash_table, uint32_t chunk_id, uint32_t from_addr, uint32_t skip, uint32_t count) : hash_table(hash_table) {
-        chunks.reserve(1024);
+    // first checkpoint of a new segment, capacity until end of block
+    MemCheckPoint *begin_segment(uint32_t &capacity) {
+        hash_table.fast_reset();
+        size_t available;
+        MemCheckPoint *chunks = (MemCheckPoint *)tail(available, alignof(MemCheckPoint));
+        capacity = available / sizeof(MemCheckPoint);
+        return chunks;
     }
-
-    #ifdef MEM_CHECK_POINT_MAP
-    void add_or_update(uint32_t chunk_id, uint32_t from_addr, uint32_t count, uint32_t skip = 0) {
-        uint32_t index = hash_table->get(chunk_id);
-        if (index == MEM_SEGMENT_HASH_TABLE_KEY_NOT_FOUND) {
-            push(chunk_id, from_addr, skip, count);
-        } else {
-            chunks[index].add_rows(from_addr, count);
-        }
+    // moves checkpoints of current segment to a block with twice its capacity at least
+    MemCheckPoint *relocate(uint32_t count, uint32_t &capacity) {
+        size_t available;
+        MemCheckPoint *chunks = (MemCheckPoint *)grow(count * sizeof(MemCheckPoint), std::max(2 * count, 16U) * sizeof(MemCheckPoint), available);
+        capacity = available / sizeof(MemCheckPoint);
+        return chunks;
     }
-    #endif
-    uint32_t size() const {
-        return chunks.size();
+    void end_segment(uint32_t count) {
+        commit(count * sizeof(MemCheckPoint));
+    }
+    inline uint32_t get(uint32_t chunk_id) {
+        return hash_table.get(chunk_id);
+    }
+    inline void set(uint32_t chunk_id, uint32_t index) {
+        hash_table.set(chunk_id, index);
     }
 };
 
-*/
-
+// Checkpoints of a segment (one by chunk), flat on arena of its planner, sorted by chunk at close.
+// Segments are created on arena (MemSegmentArena::create), they aren't deleted.
 class MemSegment {
-    #ifdef MEM_CHECK_POINT_MAP
-    std::map<uint32_t, MemCheckPoint> chunks;
-    // std::unordered_map<uint32_t, MemCheckPoint> chunks;
-    #else
-    std::vector<MemCheckPoint> chunks;
-    #endif
+    MemSegmentArena *arena;
+    MemCheckPoint *chunks;
+    uint32_t chunks_count;
+    uint32_t capacity;
 public:
     uint32_t tot_count;
     bool is_last_segment;
-    #ifdef MEM_CHECK_POINT_MAP
-    MemSegment() : tot_count(0), is_last_segment(false) {
-        // chunks.reserve(4096);
+    MemSegment(MemSegmentArena *arena) : arena(arena), chunks_count(0), tot_count(0), is_last_segment(false) {
+        chunks = arena->begin_segment(capacity);
     }
-    MemSegment(uint32_t chunk_id, uint32_t from_addr, uint32_t skip, uint32_t count): tot_count(0), is_last_segment(false) {
-        // chunks.reserve(4096);
+    MemSegment(MemSegmentArena *arena, uint32_t chunk_id, uint32_t from_addr, uint32_t skip, uint32_t count)
+    : arena(arena), chunks_count(0), tot_count(0), is_last_segment(false) {
+        chunks = arena->begin_segment(capacity);
         add_or_update(chunk_id, from_addr, skip, count);
         tot_count += count;
     }
-    #else
-    MemSegment(MemSegmentHashTable *hash_table) : is_last_segment(false) {
-        chunks.reserve(4096);
-        hash_table->fast_reset();
-    }
-    MemSegment(MemSegmentHashTable *hash_table, uint32_t chunk_id, uint32_t from_addr, uint32_t skip, uint32_t count) {
-        chunks.reserve(4096);
-        hash_table->fast_reset();
-        add_or_update(hash_table, chunk_id, from_addr, skip, count);
-    }
-    #endif
-    #ifdef MEM_CHECK_POINT_MAP
     void push(uint32_t chunk_id, uint32_t from_addr, uint32_t skip, uint32_t count) {
-        chunks.try_emplace(chunk_id, chunk_id, from_addr, skip, count, tot_count);
-        tot_count += count;
-    }
-    #else
-    void push(MemSegmentHashTable *hash_table, uint32_t chunk_id, uint32_t from_addr, uint32_t skip, uint32_t count) {
-        uint32_t index = chunks.size();
-        hash_table->set(chunk_id, index);
-        chunks.emplace_back(from_addr, skip, count);
-    }
-    #endif
-
-    #ifdef MEM_CHECK_POINT_MAP
-    void add_or_update(uint32_t chunk_id, uint32_t from_addr, uint32_t skip, uint32_t count ) {
-        auto result = chunks.try_emplace(chunk_id, std::move(MemCheckPoint(chunk_id, from_addr, skip, count, tot_count)));
-        tot_count += count;
-        #ifdef DEBUG_INFO
-        if (debug_enabled) {
-            printf("add_or_update chunk_id: %d from_addr: 0x%08X count: %d skip: %d result:%d\n", chunk_id, from_addr, count, skip, result.second);
-        }
-        #endif
-        if (!result.second) {
-            result.first->second.add_rows(from_addr, count);
+        if (chunks_count == capacity) {
+            chunks = arena->relocate(chunks_count, capacity);
         }
+        arena->set(chunk_id, chunks_count);
+        chunks[chunks_count++] = MemCheckPoint(chunk_id, from_addr, skip, count, tot_count);
     }
-    #else
-    void add_or_update(MemSegmentHashTable *hash_table, uint32_t chunk_id, uint32_t from_addr, uint32_t skip = 0, uint32_t count) {
-        uint32_t index = hash_table->get(chunk_id);
+    void add_or_update(uint32_t chunk_id, uint32_t from_addr, uint32_t skip, uint32_t count) {
+        uint32_t index = arena->get(chunk_id);
         if (index == MEM_SEGMENT_HASH_TABLE_KEY_NOT_FOUND) {
-            push(hash_table, chunk_id, from_addr, skip, count);
+            push(chunk_id, from_addr, skip, count);
         } else {
             chunks[index].add_rows(from_addr, count);
         }
+        tot_count += count;
+    }
+    // no more checkpoints could be added, arena continues after them
+    void close() {
+        std::sort(chunks, chunks + chunks_count, [](const MemCheckPoint &a, const MemCheckPoint &b) {
+            return a.chunk_id < b.chunk_id;
+        });
+        arena->end_segment(chunks_count);
     }
-    #endif
     uint32_t size() const {
-        return chunks.size();
+        return chunks_count;
     }
     void debug(uint32_t segment_id = 0) {
-        for (const auto &[chunk_id, chunk] : chunks) {
-            #ifdef MEM_CHECK_POINT_MAP
-            printf("#%d@%d [0x%08X s:%d] [0x%08X C:%d] C:%d R:%d FC:%d\n", segment_id, chunk_id, chunk.from_addr, chunk.from_skip,
+        for (uint32_t index = 0; index < chunks_count; ++index) {
+            const MemCheckPoint &chunk = chunks[index];
+            printf("#%d@%d [0x%08X s:%d] [0x%08X C:%d] C:%d R:%d FC:%d\n", segment_id, chunk.chunk_id, chunk.from_addr, chunk.from_skip,
                 chunk.to_addr, chunk.to_count, chunk.count, chunk.debug_row, chunk.from_count);
-            #endif
         }
     }
 };
-
-// class MemSegment {
-// public:
-//     #ifdef MEM_CHECK_POINT_MAP
-//     std::unordered_map<uint32_t, MemCheckPoint> chunks;
-//     #else
-//     std::vector<MemCheckPoint> chunks;
-//     #endif
-//     bool is_last_segment;
-//     MemSegment() : is_last_segment(false) {
-//         chunks.reserve(1024);
-//     }
-//     MemSegment(uint32_t chunk_id, uint32_t from_addr, uint32_t skip, uint32_t count) : is_last_segment(false) {
-//         chunks.reserve(1024);
-//         #ifdef MEM_CHECK_POINT_MAP
-//         chunks.try_emplace(chunk_id, std::move(MemCheckPoint(from_addr, skip, count)));
-//         #else
-//         chunks.emplace_back(chunk_id, from_addr, skip, count);
-//         #endif
-//     }
-//     #ifdef MEM_CHECK_POINT_MAP
-//     void add_or_update(uint32_t chunk_id, uint32_t from_addr, uint32_t count) {
-//         auto result = chunks.try_emplace(chunk_id, std::move(MemCheckPoint(from_addr, 0, count)));
-//         if (!result.second) {
-//             result.first->second.add_rows(from_addr, count);
-//         }
-//     }
-//     #endif
-//     void close() {
-//         #ifdef MEM_SEGMENT_SORT
-//         std::sort(chunks.begin(), chunks.end(), [](const MemCheckPoint &a, const MemCheckPoint &b) {
-//             return a.from_addr < b.from_addr;
-//         });
-//         #endif
-//     }
-// };
-#endif
\ No newline at end of file
+#endif
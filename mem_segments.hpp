@@ -1,35 +1,119 @@
 #ifndef __MEM_SEGMENTS_HPP__
 #define __MEM_SEGMENTS_HPP__
-#include <vector>
-#include <map>
+#include <stdint.h>
+#include <atomic>
 #include <stdexcept>
-#include <iostream>
-#include <forward_list>
-#include <mutex>
-#include <thread>
+#include <sstream>
 #include "mem_config.hpp"
 #include "mem_segment.hpp"
 
+// Segments of a plan by segment_id (dense ids), set concurrently by planners. Slots are atomic
+// pointers on blocks of MEM_SEGMENTS_BLOCK ids, a block is installed with CAS by first setter
+// that needs it (blocks of MAX_SEGMENTS ids are preallocated, reserve when bound is known), so
+// set is wait-free on allocated blocks. Readers iterate by id without locks, is_ready tells if
+// all segments (set_count) were set. Blocks are kept between runs (reset only clears slots),
+// segments are owned by arenas of planners.
 class MemSegments {
+private:
+    std::atomic<std::atomic<MemSegment *> *> blocks[MEM_SEGMENTS_MAX_BLOCKS];
+    std::atomic<uint32_t> ready;                // segments set
+    std::atomic<uint32_t> count;                // segments of plan, MEM_SEGMENTS_NO_COUNT until known
+    std::atomic<MemSegment *> *get_block(uint32_t block) {
+        std::atomic<MemSegment *> *slots = blocks[block].load(std::memory_order_acquire);
+        if (slots != nullptr) {
+            return slots;
+        }
+        std::atomic<MemSegment *> *new_slots = new std::atomic<MemSegment *>[MEM_SEGMENTS_BLOCK];
+        for (uint32_t index = 0; index < MEM_SEGMENTS_BLOCK; ++index) {
+            new_slots[index].store(nullptr, std::memory_order_relaxed);
+        }
+        if (blocks[block].compare_exchange_strong(slots, new_slots, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            return new_slots;
+        }
+        delete [] new_slots;
+        return slots;
+    }
 public:
-    std::map<uint32_t, MemSegment *> segments;
-    mutable std::mutex mtx;
-    MemSegments() {
+    MemSegments() : ready(0), count(MEM_SEGMENTS_NO_COUNT) {
+        for (uint32_t block = 0; block < MEM_SEGMENTS_MAX_BLOCKS; ++block) {
+            blocks[block].store(nullptr, std::memory_order_relaxed);
+        }
+        reserve(MAX_SEGMENTS);
     }
     ~MemSegments() {
-        for (auto segment : segments) {
-            delete segment.second;
+        for (uint32_t block = 0; block < MEM_SEGMENTS_MAX_BLOCKS; ++block) {
+            delete [] blocks[block].load(std::memory_order_relaxed);
+        }
+    }
+    // segments of previous run aren't used anymore, no one must be setting them
+    void reset() {
+        for (uint32_t block = 0; block < MEM_SEGMENTS_MAX_BLOCKS; ++block) {
+            std::atomic<MemSegment *> *slots = blocks[block].load(std::memory_order_relaxed);
+            if (slots == nullptr) continue;
+            for (uint32_t index = 0; index < MEM_SEGMENTS_BLOCK; ++index) {
+                slots[index].store(nullptr, std::memory_order_relaxed);
+            }
+        }
+        ready.store(0, std::memory_order_relaxed);
+        count.store(MEM_SEGMENTS_NO_COUNT, std::memory_order_release);
+    }
+    // allocates slots of ids below size
+    void reserve(uint32_t size) {
+        if (size > MEM_SEGMENTS_MAX_BLOCKS * MEM_SEGMENTS_BLOCK) {
+            std::ostringstream msg;
+            msg << "ERROR: MemSegments::reserve " << size << " segments out of range (" << MEM_SEGMENTS_MAX_BLOCKS * MEM_SEGMENTS_BLOCK << ")";
+            throw std::runtime_error(msg.str());
+        }
+        for (uint32_t block = 0; block * MEM_SEGMENTS_BLOCK < size; ++block) {
+            get_block(block);
         }
     }
     void set(uint32_t segment_id, MemSegment *value) {
-        std::lock_guard<std::mutex> lock(mtx);
-        segments[segment_id] = value;
+        const uint32_t block = segment_id / MEM_SEGMENTS_BLOCK;
+        if (block >= MEM_SEGMENTS_MAX_BLOCKS) {
+            std::ostringstream msg;
+            msg << "ERROR: MemSegments::set segment_id " << segment_id << " out of range (" << MEM_SEGMENTS_MAX_BLOCKS * MEM_SEGMENTS_BLOCK << ")";
+            throw std::runtime_error(msg.str());
+        }
+        get_block(block)[segment_id % MEM_SEGMENTS_BLOCK].store(value, std::memory_order_release);
+        ready.fetch_add(1, std::memory_order_acq_rel);
     }
-    void debug () const {
-        std::lock_guard<std::mutex> lock(mtx);
-        for (const auto &[segment_id, segment] : segments) {
-            segment->debug(segment_id);
+    // segments of plan, could be called before or after they are set (many times, same value)
+    void set_count(uint32_t value) {
+        count.store(value, std::memory_order_release);
+    }
+    // all segments of plan were set
+    bool is_ready() const {
+        return ready.load(std::memory_order_acquire) >= count.load(std::memory_order_acquire);
+    }
+    // nullptr if segment isn't set
+    MemSegment *get(uint32_t segment_id) const {
+        const uint32_t block = segment_id / MEM_SEGMENTS_BLOCK;
+        if (block >= MEM_SEGMENTS_MAX_BLOCKS) return nullptr;
+        const std::atomic<MemSegment *> *slots = blocks[block].load(std::memory_order_acquire);
+        return slots == nullptr ? nullptr : slots[segment_id % MEM_SEGMENTS_BLOCK].load(std::memory_order_acquire);
+    }
+    uint32_t size() const {
+        return ready.load(std::memory_order_acquire);
+    }
+    // segments set, in id order
+    template <typename Function>
+    void for_each(Function function) const {
+        for (uint32_t block = 0; block < MEM_SEGMENTS_MAX_BLOCKS; ++block) {
+            const std::atomic<MemSegment *> *slots = blocks[block].load(std::memory_order_acquire);
+            if (slots == nullptr) continue;
+            for (uint32_t index = 0; index < MEM_SEGMENTS_BLOCK; ++index) {
+                MemSegment *segment = slots[index].load(std::memory_order_acquire);
+                if (segment != nullptr) {
+                    function(block * MEM_SEGMENTS_BLOCK + index, segment);
+                }
+            }
         }
     }
+    void debug() const {
+        for_each([](uint32_t segment_id, MemSegment *segment) {
+            segment->debug(segment_id);
+        });
+    }
 };
-#endif
\ No newline at end of file
+#endif
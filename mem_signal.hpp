@@ -0,0 +1,92 @@
+#ifndef __MEM_SIGNAL_HPP__
+#define __MEM_SIGNAL_HPP__
+
+#include <stdint.h>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <immintrin.h>
+
+#include "mem_config.hpp"
+#include "tools.hpp"
+
+struct MemWaitStats {
+    uint64_t spin_us;
+    uint64_t parked_us;
+    uint32_t spins;
+    uint32_t parks;
+    MemWaitStats() : spin_us(0), parked_us(0), spins(0), parks(0) {}
+    void clear() {
+        spin_us = 0;
+        parked_us = 0;
+        spins = 0;
+        parks = 0;
+    }
+};
+
+// Spin-then-park wait/notify. Waiters spin with pause up to spin_budget checks of
+// the condition, after that they park on a condition variable. Producers only take
+// the mutex when someone is parked, so notify is almost free while consumers keep up.
+class MemSignal {
+private:
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::atomic<uint32_t> waiters;
+    std::atomic<uint32_t> spin_budget;          // could change while others wait
+public:
+    MemSignal(uint32_t spin_budget = MEM_WAIT_SPIN_BUDGET) : waiters(0), spin_budget(spin_budget) {
+    }
+    void set_spin_budget(uint32_t value) {
+        spin_budget.store(value, std::memory_order_relaxed);
+    }
+    uint32_t get_spin_budget() const {
+        return spin_budget.load(std::memory_order_relaxed);
+    }
+    // ready must be cheap and side-effect free, it's called on each spin and
+    // after each wake-up. Returns when ready() is true.
+    template <typename Ready>
+    void wait(Ready ready, MemWaitStats *stats = nullptr) {
+        if (ready()) return;
+        uint64_t init = get_usec();
+        const uint32_t budget = spin_budget.load(std::memory_order_relaxed);
+        uint32_t spin = 0;
+        while (spin < budget) {
+            ++spin;
+            _mm_pause();
+            if (ready()) {
+                if (stats) {
+                    stats->spin_us += get_usec() - init;
+                    ++stats->spins;
+                }
+                return;
+            }
+        }
+        uint64_t park_init = get_usec();
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            waiters.fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            cv.wait(lock, ready);
+            waiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+        if (stats) {
+            uint64_t end = get_usec();
+            stats->spin_us += park_init - init;
+            stats->parked_us += end - park_init;
+            ++stats->parks;
+        }
+    }
+    // must be called after the state checked by ready() was published.
+    void notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_seq_cst) == 0) return;
+        std::lock_guard<std::mutex> lock(mtx);
+        cv.notify_all();
+    }
+    void notify_always() {
+        std::lock_guard<std::mutex> lock(mtx);
+        cv.notify_all();
+    }
+};
+
+#endif
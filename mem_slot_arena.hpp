@@ -0,0 +1,93 @@
+#ifndef __MEM_SLOT_ARENA_HPP__
+#define __MEM_SLOT_ARENA_HPP__
+
+#include <stdint.h>
+#include <atomic>
+#include <stdexcept>
+#include <sstream>
+
+#include "mem_config.hpp"
+#include "tools.hpp"
+
+// Slot blocks shared by all counters. Counters take blocks by magazines of
+// MEM_SLOT_MAGAZINE_BLOCKS, a counter grows on demand until whole arena is used.
+// Magazines released (reset) go to a lock-free free-list (Treiber stack, head tagged
+// against ABA) and are reused before new ones are taken from the bump pointer.
+// Slot positions are global (word index on arena), block 0 is never handed out, so
+// position 0 means "no slot".
+class MemSlotArena {
+private:
+    uint32_t *slots;
+    uint32_t blocks;
+    uint32_t magazines;
+    uint32_t *next_free;                    // free-list links, by magazine
+    std::atomic<uint64_t> free_head;        // tag << 32 | magazine
+    std::atomic<uint32_t> next_magazine;    // bump pointer
+    std::atomic<uint32_t> magazines_in_use;
+public:
+    MemSlotArena(uint32_t blocks = ADDR_TOTAL_SLOTS) : blocks(blocks) {
+        magazines = blocks / MEM_SLOT_MAGAZINE_BLOCKS;
+        slots = (uint32_t *)lazy_alloc((size_t)magazines * MEM_SLOT_MAGAZINE_BLOCKS * ADDR_SLOT_SIZE * sizeof(uint32_t));
+        next_free = new uint32_t[magazines];
+        reset();
+    }
+    ~MemSlotArena() {
+        lazy_free(slots, (size_t)magazines * MEM_SLOT_MAGAZINE_BLOCKS * ADDR_SLOT_SIZE * sizeof(uint32_t));
+        delete [] next_free;
+    }
+    // all magazines must be released or discarded by their owners
+    void reset() {
+        free_head.store(MEM_SLOT_NO_MAGAZINE, std::memory_order_relaxed);
+        next_magazine.store(0, std::memory_order_relaxed);
+        magazines_in_use.store(0, std::memory_order_release);
+    }
+    // returns first block of a magazine
+    uint32_t acquire() {
+        uint64_t head = free_head.load(std::memory_order_acquire);
+        while ((uint32_t)head != MEM_SLOT_NO_MAGAZINE) {
+            uint32_t magazine = (uint32_t)head;
+            uint64_t next = ((head >> 32) + 1) << 32 | next_free[magazine];
+            if (free_head.compare_exchange_weak(head, next, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                magazines_in_use.fetch_add(1, std::memory_order_relaxed);
+                return magazine * MEM_SLOT_MAGAZINE_BLOCKS;
+            }
+        }
+        uint32_t magazine = next_magazine.fetch_add(1, std::memory_order_relaxed);
+        if (magazine >= magazines) {
+            next_magazine.store(magazines, std::memory_order_relaxed);
+            std::ostringstream msg;
+            msg << "ERROR: MemSlotArena no more free slots (" << magazines << " magazines of " << MEM_SLOT_MAGAZINE_BLOCKS << " blocks)";
+            throw std::runtime_error(msg.str());
+        }
+        magazines_in_use.fetch_add(1, std::memory_order_relaxed);
+        return magazine * MEM_SLOT_MAGAZINE_BLOCKS;
+    }
+    void release(uint32_t first_block) {
+        uint32_t magazine = first_block / MEM_SLOT_MAGAZINE_BLOCKS;
+        uint64_t head = free_head.load(std::memory_order_relaxed);
+        uint64_t next;
+        do {
+            next_free[magazine] = (uint32_t)head;
+            next = ((head >> 32) + 1) << 32 | magazine;
+        } while (!free_head.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+        magazines_in_use.fetch_sub(1, std::memory_order_relaxed);
+    }
+    inline uint32_t *get_slots() const {
+        return slots;
+    }
+    uint32_t get_blocks() const {
+        return magazines * MEM_SLOT_MAGAZINE_BLOCKS;
+    }
+    // words of arena, positions must be below
+    uint32_t get_size() const {
+        return magazines * MEM_SLOT_MAGAZINE_BLOCKS * ADDR_SLOT_SIZE;
+    }
+    uint32_t get_magazines_in_use() const {
+        return magazines_in_use.load(std::memory_order_relaxed);
+    }
+    uint32_t get_magazines() const {
+        return magazines;
+    }
+};
+
+#endif
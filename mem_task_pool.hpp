@@ -0,0 +1,299 @@
+#ifndef __MEM_TASK_POOL_HPP__
+#define __MEM_TASK_POOL_HPP__
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <functional>
+#include <exception>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <sstream>
+
+#include "mem_config.hpp"
+#include "mem_signal.hpp"
+#include "tools.hpp"
+
+// Task of a MemTaskPool, it's queued when it was submitted and all its dependencies finished.
+// A task must live until it's finished (pool tasks are released by MemTaskPool::release).
+// Tasks of a group (run_parallel) could be run by a worker that waits for one of them.
+class MemTask {
+    friend class MemTaskPool;
+private:
+    std::function<void()> function;
+    std::atomic<uint32_t> pending;              // dependencies not finished, + 1 until submitted
+    std::atomic<bool> finished;
+    std::mutex mtx;                             // successors and closed
+    std::vector<MemTask *> successors;
+    bool closed;                                // no more successors, it's finishing
+    const void *group;                          // nullptr for top level tasks
+public:
+    MemTask(std::function<void()> function, const void *group = nullptr) : function(std::move(function)), pending(1), finished(false), closed(false), group(group) {
+    }
+    bool is_finished() const {
+        return finished.load(std::memory_order_acquire);
+    }
+};
+
+// Persistent workers that run tasks with dependencies. Each worker has a deque, tasks submitted
+// by a worker go to its deque (taken LIFO by owner), others are distributed round robin, and
+// idle workers steal (FIFO) from other deques before parking (spin then park, MemSignal).
+// A worker that waits for a task of a group runs tasks of that group on its deque meanwhile,
+// never unrelated tasks (they could be long or wait for data of the task below them). Tasks
+// could block waiting for external data (counters wait chunks) or other tasks (ram planners
+// wait locators), pool must have a worker for each one that could be running at same time
+// (reserve) and they must not wait for tasks that wait others.
+class MemTaskPool {
+private:
+    struct Worker {
+        std::mutex mtx;
+        std::deque<MemTask *> tasks;
+        std::thread thread;
+    };
+    Worker *workers[MEM_TASK_POOL_MAX_WORKERS];
+    std::atomic<uint32_t> workers_count;
+    std::atomic<uint32_t> queued;               // tasks on deques
+    std::atomic<uint32_t> next_worker;          // round robin of external submits
+    std::atomic<bool> stopping;
+    std::atomic<uint64_t> executed;
+    std::atomic<uint64_t> steals;
+    MemSignal work_signal;                      // idle workers
+    MemSignal done_signal;                      // threads waiting a task
+    std::mutex tasks_mtx;
+    std::vector<MemTask *> tasks;               // created by pool, until release
+    static inline thread_local MemTaskPool *current_pool = nullptr;
+    static inline thread_local uint32_t current_worker = 0;
+
+    void push(MemTask *task) {
+        uint32_t index;
+        if (current_pool == this) {
+            index = current_worker;
+        } else {
+            index = next_worker.fetch_add(1, std::memory_order_relaxed) % workers_count.load(std::memory_order_acquire);
+        }
+        Worker *worker = workers[index];
+        queued.fetch_add(1, std::memory_order_seq_cst);
+        {
+            std::lock_guard<std::mutex> lock(worker->mtx);
+            worker->tasks.push_back(task);
+        }
+        work_signal.notify();
+    }
+    // own deque first (last pushed), after that oldest task of other workers
+    MemTask *take(uint32_t index) {
+        if (queued.load(std::memory_order_acquire) == 0) return nullptr;
+        const uint32_t count = workers_count.load(std::memory_order_acquire);
+        for (uint32_t i = 0; i < count; ++i) {
+            Worker *worker = workers[(index + i) % count];
+            std::lock_guard<std::mutex> lock(worker->mtx);
+            if (worker->tasks.empty()) continue;
+            MemTask *task;
+            if (i == 0) {
+                task = worker->tasks.back();
+                worker->tasks.pop_back();
+            } else {
+                task = worker->tasks.front();
+                worker->tasks.pop_front();
+                steals.fetch_add(1, std::memory_order_relaxed);
+            }
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return task;
+        }
+        return nullptr;
+    }
+    // last task of group on own deque, for a worker waiting a task of that group
+    MemTask *take_group(uint32_t index, const void *group) {
+        Worker *worker = workers[index];
+        std::lock_guard<std::mutex> lock(worker->mtx);
+        std::deque<MemTask *> &tasks = worker->tasks;
+        auto it = std::find_if(tasks.rbegin(), tasks.rend(), [group](MemTask *task) { return task->group == group; });
+        if (it == tasks.rend()) return nullptr;
+        MemTask *task = *it;
+        tasks.erase(std::prev(it.base()));
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        return task;
+    }
+    void run(MemTask *task) {
+        task->function();
+        std::vector<MemTask *> successors;
+        {
+            std::lock_guard<std::mutex> lock(task->mtx);
+            task->closed = true;
+            successors.swap(task->successors);
+        }
+        // counted before waiter could see it finished (stats of run)
+        executed.fetch_add(1, std::memory_order_relaxed);
+        // task could be destroyed by its waiter after this point, before successors run (a
+        // successor is finished only after all its dependencies)
+        task->finished.store(true, std::memory_order_release);
+        for (auto successor: successors) {
+            release_dependency(successor);
+        }
+        done_signal.notify();
+    }
+    void release_dependency(MemTask *task) {
+        if (task->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            push(task);
+        }
+    }
+    void execute(uint32_t index) {
+        current_pool = this;
+        current_worker = index;
+        while (true) {
+            MemTask *task = take(index);
+            if (task != nullptr) {
+                run(task);
+                continue;
+            }
+            if (stopping.load(std::memory_order_acquire)) break;
+            work_signal.wait([this]() {
+                return queued.load(std::memory_order_acquire) > 0 || stopping.load(std::memory_order_acquire);
+            });
+        }
+    }
+public:
+    MemTaskPool(uint32_t threads = 0) : workers_count(0), queued(0), next_worker(0), stopping(false), executed(0), steals(0) {
+        reserve(threads ? threads : std::thread::hardware_concurrency());
+    }
+    ~MemTaskPool() {
+        stopping.store(true, std::memory_order_release);
+        work_signal.notify_always();
+        const uint32_t count = workers_count.load(std::memory_order_acquire);
+        for (uint32_t index = 0; index < count; ++index) {
+            workers[index]->thread.join();
+            delete workers[index];
+        }
+        release();
+    }
+    // pool has threads workers at least, called from a thread that isn't a worker
+    void reserve(uint32_t threads) {
+        threads = std::max(1U, threads);
+        if (threads > MEM_TASK_POOL_MAX_WORKERS) {
+            std::ostringstream msg;
+            msg << "ERROR: MemTaskPool::reserve " << threads << " workers out of range (" << MEM_TASK_POOL_MAX_WORKERS << ")";
+            throw std::runtime_error(msg.str());
+        }
+        for (uint32_t index = workers_count.load(std::memory_order_acquire); index < threads; ++index) {
+            workers[index] = new Worker();
+            workers_count.store(index + 1, std::memory_order_release);
+            workers[index]->thread = std::thread([this, index]() { execute(index); });
+        }
+    }
+    // task owned by pool, valid until release
+    MemTask *create(std::function<void()> function) {
+        MemTask *task = new MemTask(std::move(function));
+        std::lock_guard<std::mutex> lock(tasks_mtx);
+        tasks.push_back(task);
+        return task;
+    }
+    // task runs after dependency, must be called before task is submitted
+    void depends(MemTask *task, MemTask *dependency) {
+        std::lock_guard<std::mutex> lock(dependency->mtx);
+        if (dependency->closed) return;
+        task->pending.fetch_add(1, std::memory_order_relaxed);
+        dependency->successors.push_back(task);
+    }
+    void depends(MemTask *task, const std::vector<MemTask *> &dependencies) {
+        for (auto dependency: dependencies) {
+            depends(task, dependency);
+        }
+    }
+    void submit(MemTask *task) {
+        release_dependency(task);
+    }
+    MemTask *submit(std::function<void()> function, const std::vector<MemTask *> &dependencies = {}) {
+        MemTask *task = create(std::move(function));
+        depends(task, dependencies);
+        submit(task);
+        return task;
+    }
+    // a worker runs tasks of group of task (queued before wait) while waiting, after that it
+    // parks as other threads
+    void wait(MemTask *task) {
+        if (current_pool == this && task->group != nullptr) {
+            MemTask *other;
+            while (!task->is_finished() && (other = take_group(current_worker, task->group)) != nullptr) {
+                run(other);
+            }
+        }
+        done_signal.wait([task]() { return task->is_finished(); });
+    }
+    // deletes tasks created by pool, all must be finished
+    void release() {
+        std::lock_guard<std::mutex> lock(tasks_mtx);
+        for (auto task: tasks) {
+            delete task;
+        }
+        tasks.clear();
+    }
+    uint32_t size() const {
+        return workers_count.load(std::memory_order_acquire);
+    }
+    // executed and steals counters, for stats of a run
+    void reset_stats() {
+        executed.store(0, std::memory_order_relaxed);
+        steals.store(0, std::memory_order_relaxed);
+    }
+    uint64_t get_executed() const {
+        return executed.load(std::memory_order_relaxed);
+    }
+    uint64_t get_steals() const {
+        return steals.load(std::memory_order_relaxed);
+    }
+    // pool of worker running current thread, nullptr if it isn't a worker
+    static MemTaskPool *get_current() {
+        return current_pool;
+    }
+};
+
+// runs function(index) for index 0..count-1 concurrently, index 0 on caller thread. Called
+// from a task, other indexes are tasks of its pool, else threads. First exception thrown by
+// any index is rethrown on caller after all indexes finished.
+template <typename Function>
+inline void run_parallel(uint32_t count, Function function) {
+    if (count <= 1) {
+        if (count == 1) function(0);
+        return;
+    }
+    std::mutex error_mtx;
+    std::exception_ptr error;
+    auto guarded = [&function, &error_mtx, &error](uint32_t index) {
+        try {
+            function(index);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mtx);
+            if (!error) error = std::current_exception();
+        }
+    };
+    MemTaskPool *pool = MemTaskPool::get_current();
+    if (pool != nullptr) {
+        std::deque<MemTask> tasks;
+        for (uint32_t index = 1; index < count; ++index) {
+            tasks.emplace_back([&guarded, index](){ guarded(index); }, &tasks);
+            pool->submit(&tasks.back());
+        }
+        guarded(0);
+        for (auto &task: tasks) {
+            pool->wait(&task);
+        }
+    } else {
+        std::vector<std::thread> threads;
+        threads.reserve(count - 1);
+        for (uint32_t index = 1; index < count; ++index) {
+            threads.emplace_back([&guarded, index](){ guarded(index); });
+        }
+        guarded(0);
+        for (auto &thread: threads) {
+            thread.join();
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+#endif
@@ -25,12 +25,15 @@
 #include "mem_context.hpp"
 #include "tools.hpp"
 #include "mem_count_and_plan.hpp"
+#include "mem_trace_map.hpp"
+#include "mem_trace_file.hpp"
 
 class MemTestChunk {
 public:
     MemCountersBusData *chunk_data;
     uint32_t chunk_size;
-    MemTestChunk(MemCountersBusData *data, uint32_t size) : chunk_data(data), chunk_size(size) {}
+    const uint8_t *encoded;
+    MemTestChunk(MemCountersBusData *data, uint32_t size, const uint8_t *encoded = nullptr) : chunk_data(data), chunk_size(size), encoded(encoded) {}
     ~MemTestChunk() {
 //        free(chunk_data);
     }
@@ -39,25 +42,41 @@ public:
 class MemTest {
 private:
     std::vector<MemTestChunk> chunks;
+    MemTraceMap trace_map;
+    MemTraceFile trace_file;
+    MemTraceDecoder decoder;
+    bool mapped;
+    bool packed;
 public:
-    MemTest() {
+    MemTest() : mapped(false), packed(false) {
         chunks.reserve(4096);
     }
     ~MemTest() {
+        if (mapped) return;
         for (auto& chunk : chunks) {
             free(chunk.chunk_data);
         }
     }
-    void load(const char *path) {
-        printf("Loading compact data...\n");
+    // path could be a directory of mem_count_data_N.bin files or a packed trace file
+    void load(const char *path, bool use_mmap = true) {
+        packed = MemTraceFile::is_trace_file(path);
+        printf("Loading compact data (%s)...\n", packed ? "trace file" : (use_mmap ? "mmap" : "read"));
+        uint64_t init = get_usec();
         uint32_t tot_chunks = 0;
         uint32_t tot_ops = 0;
         uint32_t chunk_id;
         int32_t chunk_size;
         MemCountersBusData *chunk_data;
+        const uint8_t *encoded;
         bool convert = false;
-        while ((chunk_id = chunks.size()) < MAX_CHUNKS && (chunk_size = load_from_compact_file(path, chunk_id, &chunk_data)) >=0) {
-            chunks.emplace_back(chunk_data, chunk_size);
+        mapped = use_mmap || packed;
+        if (packed) {
+            trace_file.open(path);
+        } else if (mapped) {
+            trace_map.map_directory(path, MAX_CHUNKS);
+        }
+        while ((chunk_id = chunks.size()) < MAX_CHUNKS && (chunk_size = load_chunk(path, chunk_id, &chunk_data, &encoded)) >=0) {
+            chunks.emplace_back(encoded ? nullptr : chunk_data, chunk_size, encoded);
             tot_ops += count_operations(chunk_data, chunk_size);
             tot_chunks += chunk_size;
             if (chunk_id == 0 && (chunk_data[0].flags & 0xF000000)) {
@@ -65,6 +84,14 @@ public:
                 convert = true;
             }
             if (convert) {
+                if (encoded) {
+                    throw std::runtime_error("ERROR: MemTest::load format conversion not supported on encoded trace");
+                }
+                if (packed) {
+                    if (chunk_id == 0) trace_file.make_writable();
+                } else if (mapped) {
+                    trace_map.make_writable(chunk_id);
+                }
                 for (int32_t index = 0; index < chunk_size; ++index) {
                     chunk_data[index].flags = ((chunk_data[index].flags & 0x08000000) >> 11) | ((chunk_data[index].flags & 0xF0000000) >> 28);
                 }
@@ -107,33 +134,78 @@ public:
             // #endif
             if (chunk_id % 100 == 0) printf("Loaded chunk %d with size %d\n", chunk_id, chunk_size);
         }
-        printf("chunks: %ld  tot_chunks: %d tot_ops: %d tot_time:%ld (ms)\n", chunks.size(), tot_chunks, tot_ops, (chunks.size() * TIME_US_BY_CHUNK)/1000);
+        printf("chunks: %ld  tot_chunks: %d tot_ops: %d tot_time:%ld (ms) load:%ld ms\n", chunks.size(), tot_chunks, tot_ops, (chunks.size() * TIME_US_BY_CHUNK)/1000, (get_usec() - init) / 1000);
     }
-    void execute(void) {
+    // encoded chunks are decoded on chunk_data only to be inspected by load
+    int32_t load_chunk(const char *path, uint32_t chunk_id, MemCountersBusData **chunk_data, const uint8_t **encoded) {
+        *encoded = nullptr;
+        if (!mapped) {
+            return load_from_compact_file(path, chunk_id, chunk_data);
+        }
+        if (packed) {
+            if (chunk_id >= trace_file.size()) {
+                return -1;
+            }
+            if (!trace_file.verify(chunk_id)) {
+                std::ostringstream msg;
+                msg << "ERROR: MemTest::load_chunk checksum error on chunk " << chunk_id;
+                throw std::runtime_error(msg.str());
+            }
+            if (trace_file.is_encoded()) {
+                uint32_t records;
+                *encoded = trace_file.get_encoded_chunk(chunk_id);
+                *chunk_data = (MemCountersBusData *)decoder.decode(*encoded, records);
+                return records;
+            }
+            *chunk_data = trace_file.get_chunk_data(chunk_id);
+            return trace_file.get_chunk_size(chunk_id);
+        }
+        if (chunk_id >= trace_map.size()) {
+            return -1;
+        }
+        const MemChunk &chunk = trace_map.get_chunk(chunk_id);
+        *chunk_data = chunk.data;
+        return chunk.count;
+    }
+    // runs > 1 executes same trace again on same instance, reset between runs
+    void execute(uint32_t runs = 1) {
         printf("Starting...\n");
         auto cp = create_mem_count_and_plan();
-        printf("Executing...\n");
-        execute_mem_count_and_plan(cp);
-        uint64_t init = get_usec();
-        uint32_t chunk_id = 0;
-        for (auto& chunk : chunks) {
-            uint64_t chunk_ready = init + (uint64_t)(chunk_id+1) * TIME_US_BY_CHUNK;
-            uint64_t current = get_usec();
-            if (current < chunk_ready) {
-                usleep(chunk_ready - current);
+        for (uint32_t run = 0; run < runs; ++run) {
+            if (run > 0) {
+                reset_mem_count_and_plan(cp);
             }
-            MemCountersBusData *data = chunk.chunk_data;
-            uint32_t chunk_size = chunk.chunk_size;
+            printf("Executing...\n");
+            execute_mem_count_and_plan(cp);
+            uint64_t init = get_usec();
+            uint32_t chunk_id = 0;
+            for (auto& chunk : chunks) {
+                uint64_t chunk_ready = init + (uint64_t)(chunk_id+1) * TIME_US_BY_CHUNK;
+                uint64_t current = get_usec();
+                if (current < chunk_ready) {
+                    usleep(chunk_ready - current);
+                }
+                MemCountersBusData *data = chunk.chunk_data;
+                uint32_t chunk_size = chunk.chunk_size;
 //            uint32_t j = chunk_size - 1;
 //            printf("CHUNK[%4d] 0:[%08X %d %c] ... %d:[%08X %d %c]\n", chunk_id,
 //                data[0].addr, data[0].flags & 0xFFFF, data[0].flags & 0x10000 ? 'R':'W', j,
 //                data[j].addr, data[j].flags & 0xFFFF, data[j].flags & 0x10000 ? 'R':'W');
-            add_chunk_mem_count_and_plan(cp, data, chunk_size);
-            ++chunk_id;
+                if (chunk.encoded) {
+                    add_encoded_chunk_mem_count_and_plan(cp, chunk.encoded, chunk_size);
+                } else {
+                    add_chunk_mem_count_and_plan(cp, data, chunk_size);
+                }
+                ++chunk_id;
+                if (MEM_METRICS_SAMPLE_CHUNKS && (chunk_id % MEM_METRICS_SAMPLE_CHUNKS) == 0) {
+                    printf("METRICS %s\n", metrics_mem_count_and_plan(cp).c_str());
+                }
+            }
+            set_completed_mem_count_and_plan(cp);
+            wait_mem_count_and_plan(cp);
+            stats_mem_count_and_plan(cp);
         }
-        set_completed_mem_count_and_plan(cp);
-        wait_mem_count_and_plan(cp);
-        stats_mem_count_and_plan(cp);
+        destroy_mem_count_and_plan(cp);
     }
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,287 @@
+#ifndef __MEM_TRACE_CODEC_HPP__
+#define __MEM_TRACE_CODEC_HPP__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <sstream>
+#include <immintrin.h>
+
+#include "mem_types.hpp"
+#include "mem_config.hpp"
+
+// Encoded chunk, frame-of-reference bit-packing by blocks of MEM_CODEC_BLOCK records:
+//
+//   [MemEncodedChunkHeader][block 0][block 1]...[padding MEM_CODEC_PADDING]
+//   block: [MemEncodedBlockHeader][addr deltas: addr_bits x BLOCK][flags: flags_bits x BLOCK]
+//
+// addr is stored as zigzag delta with previous addr (block header has addr before block),
+// flags as index on a chunk dictionary of distinct flags, or raw (32 bits) if chunk has
+// more than MEM_CODEC_MAX_FLAGS distinct flags. Values are packed in groups of 8, a group
+// of 8 values of b bits uses exactly b bytes, it's the unit of vectorized decoder.
+
+#define MEM_CODEC_BLOCK 256
+#define MEM_CODEC_GROUP 8
+#define MEM_CODEC_MAX_FLAGS 16
+#define MEM_CODEC_RAW_FLAGS_BITS 32
+#define MEM_CODEC_PADDING 16
+
+struct MemEncodedChunkHeader {
+    uint32_t records;
+    uint32_t flags_count;
+    uint32_t flags_dict[MEM_CODEC_MAX_FLAGS];
+};
+
+struct MemEncodedBlockHeader {
+    uint32_t prev_addr;
+    uint8_t addr_bits;
+    uint8_t flags_bits;
+    uint16_t reserved;
+};
+
+class MemTraceCodec {
+private:
+    static inline uint32_t bits_of(uint32_t value) {
+        return value ? 32 - __builtin_clz(value) : 0;
+    }
+    static void pack(uint8_t *out, const uint32_t *values, uint32_t bits) {
+        if (bits == 0) return;
+        memset(out, 0, MEM_CODEC_BLOCK * bits / 8);
+        for (uint32_t i = 0; i < MEM_CODEC_BLOCK; ++i) {
+            uint64_t bit_pos = (uint64_t)i * bits;
+            uint64_t value = (uint64_t)values[i] << (bit_pos & 7);
+            uint8_t *p = out + (bit_pos >> 3);
+            for (uint32_t byte = 0; byte < ((bit_pos & 7) + bits + 7) / 8; ++byte) {
+                p[byte] |= (uint8_t)(value >> (8 * byte));
+            }
+        }
+    }
+public:
+    static inline uint32_t block_size(uint32_t addr_bits, uint32_t flags_bits) {
+        return sizeof(MemEncodedBlockHeader) + (MEM_CODEC_BLOCK / 8) * (addr_bits + flags_bits);
+    }
+    // encodes records on out (appended), returns number of bytes encoded
+    static size_t encode(const MemCountersBusData *data, uint32_t records, std::vector<uint8_t> &out) {
+        size_t init = out.size();
+        MemEncodedChunkHeader header;
+        memset(&header, 0, sizeof(header));
+        header.records = records;
+        for (uint32_t i = 0; i < records && header.flags_count <= MEM_CODEC_MAX_FLAGS; ++i) {
+            uint32_t index = 0;
+            while (index < header.flags_count && header.flags_dict[index] != data[i].flags) ++index;
+            if (index < header.flags_count) continue;
+            if (header.flags_count == MEM_CODEC_MAX_FLAGS) {
+                header.flags_count = 0;
+                memset(header.flags_dict, 0, sizeof(header.flags_dict));
+                break;
+            }
+            header.flags_dict[header.flags_count++] = data[i].flags;
+        }
+        uint32_t flags_bits = MEM_CODEC_RAW_FLAGS_BITS;
+        if (header.flags_count > 0) {
+            flags_bits = bits_of(header.flags_count - 1);
+        }
+        out.insert(out.end(), (const uint8_t *)&header, (const uint8_t *)&header + sizeof(header));
+
+        uint32_t deltas[MEM_CODEC_BLOCK];
+        uint32_t flags[MEM_CODEC_BLOCK];
+        uint32_t prev_addr = 0;
+        for (uint32_t from = 0; from < records; from += MEM_CODEC_BLOCK) {
+            uint32_t count = std::min(records - from, (uint32_t)MEM_CODEC_BLOCK);
+            MemEncodedBlockHeader block;
+            block.prev_addr = prev_addr;
+            block.flags_bits = flags_bits;
+            block.reserved = 0;
+            uint32_t max_delta = 0;
+            for (uint32_t i = 0; i < MEM_CODEC_BLOCK; ++i) {
+                if (i < count) {
+                    const MemCountersBusData &record = data[from + i];
+                    int32_t delta = (int32_t)(record.addr - prev_addr);
+                    deltas[i] = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+                    prev_addr = record.addr;
+                    uint32_t index = 0;
+                    if (header.flags_count > 0) {
+                        while (header.flags_dict[index] != record.flags) ++index;
+                        flags[i] = index;
+                    } else {
+                        flags[i] = record.flags;
+                    }
+                } else {
+                    deltas[i] = 0;
+                    flags[i] = 0;
+                }
+                max_delta |= deltas[i];
+            }
+            block.addr_bits = bits_of(max_delta);
+            size_t pos = out.size();
+            out.resize(pos + block_size(block.addr_bits, flags_bits));
+            memcpy(out.data() + pos, &block, sizeof(block));
+            pos += sizeof(block);
+            pack(out.data() + pos, deltas, block.addr_bits);
+            pack(out.data() + pos + (MEM_CODEC_BLOCK / 8) * block.addr_bits, flags, flags_bits);
+        }
+        out.resize(out.size() + MEM_CODEC_PADDING, 0);
+        return out.size() - init;
+    }
+    static inline uint32_t get_records(const uint8_t *encoded) {
+        return ((const MemEncodedChunkHeader *)encoded)->records;
+    }
+};
+
+// Decoder owns a reusable buffer, each consumer thread has its own decoder and decodes
+// the chunk just before process it.
+class MemTraceDecoder {
+private:
+    MemCountersBusData *buffer;
+    uint32_t capacity;
+
+    static inline uint32_t unpack_one(const uint8_t *group, uint32_t j, uint32_t bits) {
+        uint32_t bit_pos = j * bits;
+        uint64_t value;
+        memcpy(&value, group + (bit_pos >> 3), 8);
+        return (uint32_t)((value >> (bit_pos & 7)) & ((1ULL << bits) - 1));
+    }
+    static void decode_block_scalar(const MemEncodedChunkHeader *header, const MemEncodedBlockHeader *block,
+                                    MemCountersBusData *out, uint32_t count) {
+        const uint8_t *addr_data = (const uint8_t *)(block + 1);
+        const uint8_t *flags_data = addr_data + (MEM_CODEC_BLOCK / 8) * block->addr_bits;
+        const uint32_t addr_bits = block->addr_bits;
+        const uint32_t flags_bits = block->flags_bits;
+        uint32_t addr = block->prev_addr;
+        for (uint32_t i = 0; i < count; ++i) {
+            const uint32_t group = i / MEM_CODEC_GROUP;
+            const uint32_t j = i % MEM_CODEC_GROUP;
+            uint32_t delta = addr_bits ? unpack_one(addr_data + group * addr_bits, j, addr_bits) : 0;
+            addr += (delta >> 1) ^ (0 - (delta & 1));
+            out[i].addr = addr;
+            uint32_t flags = flags_bits ? unpack_one(flags_data + group * flags_bits, j, flags_bits) : 0;
+            out[i].flags = header->flags_count ? header->flags_dict[flags] : flags;
+        }
+    }
+    #ifdef __AVX2__
+    static inline __m256i unpack_group_avx2(const uint8_t *group, uint32_t bits) {
+        const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        const __m256i bit_pos = _mm256_mullo_epi32(lane, _mm256_set1_epi32(bits));
+        const __m256i byte_pos = _mm256_srli_epi32(bit_pos, 3);
+        const __m256i shift = _mm256_and_si256(bit_pos, _mm256_set1_epi32(7));
+        if (bits <= 25) {
+            // value fits on 32 bits loaded from its first byte
+            __m256i values = _mm256_i32gather_epi32((const int *)group, byte_pos, 1);
+            values = _mm256_srlv_epi32(values, shift);
+            return _mm256_and_si256(values, _mm256_set1_epi32((uint32_t)((1ULL << bits) - 1)));
+        }
+        const __m128i byte_lo = _mm256_castsi256_si128(byte_pos);
+        const __m128i byte_hi = _mm256_extracti128_si256(byte_pos, 1);
+        __m256i lo = _mm256_i32gather_epi64((const long long *)group, byte_lo, 1);
+        __m256i hi = _mm256_i32gather_epi64((const long long *)group, byte_hi, 1);
+        lo = _mm256_srlv_epi64(lo, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(shift)));
+        hi = _mm256_srlv_epi64(hi, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(shift, 1)));
+        // take low 32 bits of each 64-bit lane
+        const __m256i even = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+        lo = _mm256_permutevar8x32_epi32(lo, even);
+        hi = _mm256_permutevar8x32_epi32(hi, even);
+        __m256i values = _mm256_blend_epi32(lo, hi, 0xF0);
+        if (bits == 32) return values;
+        return _mm256_and_si256(values, _mm256_set1_epi32((uint32_t)((1ULL << bits) - 1)));
+    }
+    static void decode_block_avx2(const MemEncodedChunkHeader *header, const MemEncodedBlockHeader *block,
+                                  MemCountersBusData *out, uint32_t count) {
+        const uint8_t *addr_data = (const uint8_t *)(block + 1);
+        const uint8_t *flags_data = addr_data + (MEM_CODEC_BLOCK / 8) * block->addr_bits;
+        const uint32_t addr_bits = block->addr_bits;
+        const uint32_t flags_bits = block->flags_bits;
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i one = _mm256_set1_epi32(1);
+        const __m256i last_lane = _mm256_set1_epi32(7);
+        const __m256i lane3 = _mm256_set1_epi32(3);
+        const bool use_dict = header->flags_count > 0;
+        const __m256i dict_lo = _mm256_loadu_si256((const __m256i *)header->flags_dict);
+        const __m256i dict_hi = _mm256_loadu_si256((const __m256i *)(header->flags_dict + 8));
+        __m256i carry = _mm256_set1_epi32(block->prev_addr);
+        uint32_t groups = (count + MEM_CODEC_GROUP - 1) / MEM_CODEC_GROUP;
+        for (uint32_t group = 0; group < groups; ++group) {
+            __m256i addr = zero;
+            if (addr_bits) {
+                __m256i delta = unpack_group_avx2(addr_data + group * addr_bits, addr_bits);
+                // zigzag decode
+                delta = _mm256_xor_si256(_mm256_srli_epi32(delta, 1), _mm256_sub_epi32(zero, _mm256_and_si256(delta, one)));
+                // inclusive prefix sum of 8 lanes
+                delta = _mm256_add_epi32(delta, _mm256_slli_si256(delta, 4));
+                delta = _mm256_add_epi32(delta, _mm256_slli_si256(delta, 8));
+                delta = _mm256_add_epi32(delta, _mm256_blend_epi32(zero, _mm256_permutevar8x32_epi32(delta, lane3), 0xF0));
+                addr = delta;
+            }
+            addr = _mm256_add_epi32(addr, carry);
+            carry = _mm256_permutevar8x32_epi32(addr, last_lane);
+
+            __m256i flags = flags_bits ? unpack_group_avx2(flags_data + group * flags_bits, flags_bits) : zero;
+            if (use_dict) {
+                __m256i flags_lo = _mm256_permutevar8x32_epi32(dict_lo, flags);
+                __m256i flags_hi = _mm256_permutevar8x32_epi32(dict_hi, flags);
+                __m256i is_hi = _mm256_cmpgt_epi32(flags, _mm256_set1_epi32(7));
+                flags = _mm256_blendv_epi8(flags_lo, flags_hi, is_hi);
+            }
+            // interleave addr,flags to records
+            __m256i lo = _mm256_unpacklo_epi32(addr, flags);
+            __m256i hi = _mm256_unpackhi_epi32(addr, flags);
+            __m256i r0 = _mm256_permute2x128_si256(lo, hi, 0x20);
+            __m256i r1 = _mm256_permute2x128_si256(lo, hi, 0x31);
+            uint32_t index = group * MEM_CODEC_GROUP;
+            if (index + MEM_CODEC_GROUP <= count) {
+                _mm256_storeu_si256((__m256i *)(out + index), r0);
+                _mm256_storeu_si256((__m256i *)(out + index + 4), r1);
+            } else {
+                MemCountersBusData tmp[MEM_CODEC_GROUP];
+                _mm256_storeu_si256((__m256i *)tmp, r0);
+                _mm256_storeu_si256((__m256i *)(tmp + 4), r1);
+                memcpy(out + index, tmp, (count - index) * sizeof(MemCountersBusData));
+            }
+        }
+    }
+    #endif
+public:
+    MemTraceDecoder() : buffer(nullptr), capacity(0) {
+    }
+    ~MemTraceDecoder() {
+        free(buffer);
+    }
+    void reserve(uint32_t records) {
+        if (records <= capacity) return;
+        free(buffer);
+        capacity = (records + MEM_CODEC_BLOCK - 1) & ~(MEM_CODEC_BLOCK - 1);
+        buffer = (MemCountersBusData *)std::aligned_alloc(64, capacity * sizeof(MemCountersBusData));
+        if (buffer == nullptr) {
+            std::ostringstream msg;
+            msg << "ERROR: MemTraceDecoder::reserve " << records << " records";
+            throw std::runtime_error(msg.str());
+        }
+    }
+    // decodes chunk on internal buffer, pointer is valid until next decode
+    const MemCountersBusData *decode(const uint8_t *encoded, uint32_t &records, bool vectorized = true) {
+        const MemEncodedChunkHeader *header = (const MemEncodedChunkHeader *)encoded;
+        records = header->records;
+        reserve(records);
+        const uint8_t *pos = encoded + sizeof(MemEncodedChunkHeader);
+        for (uint32_t from = 0; from < records; from += MEM_CODEC_BLOCK) {
+            const MemEncodedBlockHeader *block = (const MemEncodedBlockHeader *)pos;
+            uint32_t count = std::min(records - from, (uint32_t)MEM_CODEC_BLOCK);
+            #ifdef __AVX2__
+            if (vectorized) {
+                decode_block_avx2(header, block, buffer + from, count);
+            } else {
+                decode_block_scalar(header, block, buffer + from, count);
+            }
+            #else
+            decode_block_scalar(header, block, buffer + from, count);
+            #endif
+            pos += MemTraceCodec::block_size(block->addr_bits, block->flags_bits);
+        }
+        return buffer;
+    }
+};
+
+#endif
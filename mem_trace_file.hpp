@@ -0,0 +1,284 @@
+#ifndef __MEM_TRACE_FILE_HPP__
+#define __MEM_TRACE_FILE_HPP__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <vector>
+#include <stdexcept>
+#include <sstream>
+#include <immintrin.h>
+
+#include "mem_types.hpp"
+#include "mem_config.hpp"
+#include "tools.hpp"
+#include "mem_trace_codec.hpp"
+
+// Single file trace container:
+//
+//   [header][chunk 0][chunk 1]...[chunk N-1][index]
+//
+// header is at offset 0, each chunk starts on a MEM_TRACE_FILE_ALIGN boundary and index
+// (one entry by chunk) is written at end, header.index_offset points to it. All file
+// could be mapped with one mmap, and chunk i found in O(1) through index[i].
+// With MEM_TRACE_FLAG_ENCODED chunks are stored encoded (mem_trace_codec.hpp).
+
+#define MEM_TRACE_FILE_MAGIC 0x45434152544D454DULL // "MEMTRACE"
+#define MEM_TRACE_FILE_VERSION 1
+#define MEM_TRACE_FILE_ALIGN 4096
+#define MEM_TRACE_FLAG_CHECKSUM 0x00000001
+#define MEM_TRACE_FLAG_ENCODED  0x00000002
+
+struct MemTraceFileHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint32_t chunks;
+    uint32_t align;
+    uint64_t index_offset;
+    uint64_t file_size;
+};
+
+struct MemTraceFileIndexEntry {
+    uint64_t offset;    // absolute offset of chunk data
+    uint64_t length;    // bytes of chunk data
+    uint32_t records;   // MemCountersBusData records
+    uint32_t checksum;  // crc32c of chunk data (as stored), 0 if file hasn't MEM_TRACE_FLAG_CHECKSUM
+};
+
+inline uint32_t mem_trace_checksum(const void *data, size_t length) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint64_t crc = 0xFFFFFFFF;
+    #ifdef __SSE4_2__
+    while (length >= 8) {
+        uint64_t value;
+        memcpy(&value, bytes, 8);
+        crc = _mm_crc32_u64(crc, value);
+        bytes += 8;
+        length -= 8;
+    }
+    while (length > 0) {
+        crc = _mm_crc32_u8((uint32_t)crc, *bytes++);
+        --length;
+    }
+    #else
+    while (length > 0) {
+        crc ^= *bytes++;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+        }
+        --length;
+    }
+    #endif
+    return (uint32_t)crc ^ 0xFFFFFFFF;
+}
+
+class MemTraceFileWriter {
+private:
+    int fd;
+    uint32_t flags;
+    uint64_t pos;
+    std::vector<MemTraceFileIndexEntry> index;
+    std::vector<uint8_t> encoded;
+    bool write_at(const void *data, size_t length, uint64_t offset) {
+        const uint8_t *bytes = (const uint8_t *)data;
+        while (length > 0) {
+            ssize_t bytes_written = pwrite(fd, bytes, length, offset);
+            if (bytes_written < 0) {
+                perror("Error writing trace file");
+                return false;
+            }
+            bytes += bytes_written;
+            offset += bytes_written;
+            length -= bytes_written;
+        }
+        return true;
+    }
+public:
+    MemTraceFileWriter() : fd(-1), flags(0), pos(0) {
+    }
+    ~MemTraceFileWriter() {
+        close();
+    }
+    bool open(const char *filename, bool checksum = true, bool encode = false) {
+        fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            perror("Error opening trace file for writing");
+            return false;
+        }
+        flags = (checksum ? MEM_TRACE_FLAG_CHECKSUM : 0) | (encode ? MEM_TRACE_FLAG_ENCODED : 0);
+        pos = MEM_TRACE_FILE_ALIGN;
+        index.clear();
+        return true;
+    }
+    bool add_chunk(const MemCountersBusData *data, uint32_t records) {
+        if (index.size() >= MAX_CHUNKS) {
+            fprintf(stderr, "Error: trace file full, max %d chunks\n", MAX_CHUNKS);
+            return false;
+        }
+        const void *chunk_data = data;
+        uint64_t length = (uint64_t)records * sizeof(MemCountersBusData);
+        if (flags & MEM_TRACE_FLAG_ENCODED) {
+            encoded.clear();
+            length = MemTraceCodec::encode(data, records, encoded);
+            chunk_data = encoded.data();
+        }
+        uint32_t checksum = (flags & MEM_TRACE_FLAG_CHECKSUM) ? mem_trace_checksum(chunk_data, length) : 0;
+        if (!write_at(chunk_data, length, pos)) {
+            return false;
+        }
+        index.push_back(MemTraceFileIndexEntry{pos, length, records, checksum});
+        pos = (pos + length + MEM_TRACE_FILE_ALIGN - 1) & ~((uint64_t)MEM_TRACE_FILE_ALIGN - 1);
+        return true;
+    }
+    bool close() {
+        if (fd < 0) return true;
+        uint64_t index_offset = pos;
+        uint64_t index_length = index.size() * sizeof(MemTraceFileIndexEntry);
+        MemTraceFileHeader header;
+        memset(&header, 0, sizeof(header));
+        header.magic = MEM_TRACE_FILE_MAGIC;
+        header.version = MEM_TRACE_FILE_VERSION;
+        header.flags = flags;
+        header.chunks = index.size();
+        header.align = MEM_TRACE_FILE_ALIGN;
+        header.index_offset = index_offset;
+        header.file_size = index_offset + index_length;
+        bool result = write_at(index.data(), index_length, index_offset) && write_at(&header, sizeof(header), 0);
+        ::close(fd);
+        fd = -1;
+        return result;
+    }
+    uint32_t size() const {
+        return index.size();
+    }
+    // packs a directory of mem_count_data_N.bin files into one trace file
+    static int32_t pack_directory(const char *path, const char *filename, bool checksum = true, bool encode = false) {
+        MemTraceFileWriter writer;
+        if (!writer.open(filename, checksum, encode)) {
+            return -1;
+        }
+        MemCountersBusData *chunk_data;
+        int32_t chunk_size;
+        uint32_t chunk_id = 0;
+        while (chunk_id < MAX_CHUNKS && (chunk_size = load_from_compact_file(path, chunk_id, &chunk_data)) >= 0) {
+            bool done = writer.add_chunk(chunk_data, chunk_size);
+            free(chunk_data);
+            if (!done) return -1;
+            ++chunk_id;
+        }
+        return writer.close() ? (int32_t)chunk_id : -1;
+    }
+};
+
+class MemTraceFile {
+private:
+    uint8_t *base;
+    size_t length;
+    const MemTraceFileHeader *header;
+    const MemTraceFileIndexEntry *index;
+public:
+    MemTraceFile() : base(nullptr), length(0), header(nullptr), index(nullptr) {
+    }
+    ~MemTraceFile() {
+        close();
+    }
+    static bool is_trace_file(const char *filename) {
+        struct stat st;
+        return stat(filename, &st) == 0 && S_ISREG(st.st_mode);
+    }
+    void open(const char *filename) {
+        int fd = ::open(filename, O_RDONLY);
+        if (fd < 0) {
+            std::ostringstream msg;
+            msg << "ERROR: MemTraceFile::open " << filename << " not found";
+            throw std::runtime_error(msg.str());
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(MemTraceFileHeader)) {
+            ::close(fd);
+            std::ostringstream msg;
+            msg << "ERROR: MemTraceFile::open " << filename << " invalid size";
+            throw std::runtime_error(msg.str());
+        }
+        length = st.st_size;
+        void *addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            std::ostringstream msg;
+            msg << "ERROR: MemTraceFile::open " << filename << " mmap failed";
+            throw std::runtime_error(msg.str());
+        }
+        base = (uint8_t *)addr;
+        header = (const MemTraceFileHeader *)base;
+        if (header->magic != MEM_TRACE_FILE_MAGIC || header->version != MEM_TRACE_FILE_VERSION ||
+            header->file_size > length || header->chunks > MAX_CHUNKS || header->index_offset > length ||
+            header->chunks * sizeof(MemTraceFileIndexEntry) > length - header->index_offset) {
+            close();
+            std::ostringstream msg;
+            msg << "ERROR: MemTraceFile::open " << filename << " invalid header";
+            throw std::runtime_error(msg.str());
+        }
+        index = (const MemTraceFileIndexEntry *)(base + header->index_offset);
+        // chunks are used without bound checks, entries must be inside file (encoded chunks
+        // have their own length, raw chunks are records * sizeof(MemCountersBusData))
+        for (uint32_t chunk_id = 0; chunk_id < header->chunks; ++chunk_id) {
+            const MemTraceFileIndexEntry &entry = index[chunk_id];
+            if (entry.offset % MEM_TRACE_FILE_ALIGN || entry.offset < sizeof(MemTraceFileHeader) ||
+                entry.offset > length || entry.length > length - entry.offset ||
+                (!(header->flags & MEM_TRACE_FLAG_ENCODED) && entry.length != (uint64_t)entry.records * sizeof(MemCountersBusData))) {
+                close();
+                std::ostringstream msg;
+                msg << "ERROR: MemTraceFile::open " << filename << " invalid index entry " << chunk_id;
+                throw std::runtime_error(msg.str());
+            }
+        }
+        madvise(base, length, MADV_SEQUENTIAL);
+        madvise(base, length, MADV_WILLNEED);
+    }
+    void close() {
+        if (base != nullptr) {
+            munmap(base, length);
+        }
+        base = nullptr;
+        length = 0;
+        header = nullptr;
+        index = nullptr;
+    }
+    uint32_t size() const {
+        return header ? header->chunks : 0;
+    }
+    uint32_t get_chunk_size(uint32_t chunk_id) const {
+        return index[chunk_id].records;
+    }
+    MemCountersBusData *get_chunk_data(uint32_t chunk_id) const {
+        return (MemCountersBusData *)(base + index[chunk_id].offset);
+    }
+    bool is_encoded() const {
+        return header && (header->flags & MEM_TRACE_FLAG_ENCODED);
+    }
+    const uint8_t *get_encoded_chunk(uint32_t chunk_id) const {
+        return base + index[chunk_id].offset;
+    }
+    bool has_checksum() const {
+        return header && (header->flags & MEM_TRACE_FLAG_CHECKSUM);
+    }
+    bool verify(uint32_t chunk_id) const {
+        if (!has_checksum()) return true;
+        return mem_trace_checksum(base + index[chunk_id].offset, index[chunk_id].length) == index[chunk_id].checksum;
+    }
+    // mapping is private, written pages are copied on write, file isn't modified.
+    void make_writable() {
+        if (base == nullptr) return;
+        if (mprotect(base, length, PROT_READ | PROT_WRITE) < 0) {
+            throw std::runtime_error("ERROR: MemTraceFile::make_writable");
+        }
+    }
+};
+
+#endif
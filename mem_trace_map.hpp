@@ -0,0 +1,104 @@
+#ifndef __MEM_TRACE_MAP_HPP__
+#define __MEM_TRACE_MAP_HPP__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <vector>
+#include <stdexcept>
+#include <sstream>
+
+#include "mem_types.hpp"
+#include "mem_config.hpp"
+#include "tools.hpp"
+
+// Read-only mappings of mem_count_data_N.bin chunk files. Chunk data is used in place,
+// pages are loaded by the kernel when counters touch them, nothing is copied.
+class MemTraceMap {
+private:
+    struct Mapping {
+        void *addr;
+        size_t length;
+    };
+    std::vector<Mapping> mappings;
+    std::vector<MemChunk> chunks;
+public:
+    MemTraceMap() {
+    }
+    ~MemTraceMap() {
+        clear();
+    }
+    void clear() {
+        for (auto &mapping: mappings) {
+            if (mapping.addr != nullptr) {
+                munmap(mapping.addr, mapping.length);
+            }
+        }
+        mappings.clear();
+        chunks.clear();
+    }
+    // map one chunk file, returns number of MemCountersBusData or -1 if file not exists.
+    int32_t map_file(const char *filename) {
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0) {
+            return -1;
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            perror("Error getting file size");
+            close(fd);
+            return -1;
+        }
+        int32_t chunk_size = st.st_size / sizeof(MemCountersBusData);
+        size_t length = sizeof(MemCountersBusData) * chunk_size;
+        void *addr = nullptr;
+        if (length > 0) {
+            addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED) {
+                perror("Error mapping file");
+                close(fd);
+                return -1;
+            }
+            madvise(addr, length, MADV_SEQUENTIAL);
+            madvise(addr, length, MADV_WILLNEED);
+        }
+        close(fd);
+        mappings.push_back(Mapping{addr, length});
+        chunks.push_back(MemChunk{(MemCountersBusData *)addr, (uint32_t)chunk_size, nullptr});
+        return chunk_size;
+    }
+    // map all consecutive chunk files of directory path, returns number of chunks mapped.
+    uint32_t map_directory(const char *path, uint32_t max_chunks = MAX_CHUNKS) {
+        char filename[256];
+        uint32_t chunk_id = chunks.size();
+        while (chunk_id < max_chunks) {
+            snprintf(filename, sizeof(filename), "%s/mem_count_data_%d.bin", path, chunk_id);
+            if (map_file(filename) < 0) break;
+            ++chunk_id;
+        }
+        return chunks.size();
+    }
+    // chunks are mapped read-only, only legacy format conversion needs write on them.
+    // Private mapping, written pages are copied on write, file isn't modified.
+    void make_writable(uint32_t chunk_id) {
+        const Mapping &mapping = mappings[chunk_id];
+        if (mapping.addr == nullptr) return;
+        if (mprotect(mapping.addr, mapping.length, PROT_READ | PROT_WRITE) < 0) {
+            std::ostringstream msg;
+            msg << "ERROR: MemTraceMap::make_writable chunk " << chunk_id;
+            throw std::runtime_error(msg.str());
+        }
+    }
+    uint32_t size() const {
+        return chunks.size();
+    }
+    const MemChunk &get_chunk(uint32_t chunk_id) const {
+        return chunks[chunk_id];
+    }
+};
+
+#endif
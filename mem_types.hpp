@@ -12,6 +12,7 @@ struct MemCountersBusData {
 struct MemChunk {
     MemCountersBusData *data;
     uint32_t count;
+    const uint8_t *encoded; // if not null, chunk is encoded (see mem_trace_codec.hpp) and data is null
 };
 
 struct MemCountTrace {
@@ -12,6 +12,7 @@
 #include <vector>
 
 #include "mem_types.hpp"
+#include "mem_trace_file.hpp"
 
 #define MEM_BUS_DATA_SIZE 7 // Replace with your actual size
 
@@ -19,11 +20,6 @@ typedef struct {
     uint64_t data[MEM_BUS_DATA_SIZE];
 } BusDataChunk;
 
-typedef struct {
-    uint32_t addr;
-    uint32_t flags;
-} MemCountersBusData;
-
 int load_from_file(size_t chunk_id, BusDataChunk** chunk) {
     char filename[256];
     snprintf(filename, sizeof(filename), "../bus_data2/mem_%ld.bin", chunk_id);
@@ -60,13 +56,19 @@ int load_from_file(size_t chunk_id, BusDataChunk** chunk) {
 }
 
 
-MemCountersBusData *compact_and_save(int chunk, BusDataChunk* chunk_data, int count) {
+MemCountersBusData *compact(BusDataChunk* chunk_data, int count) {
     int size = sizeof(MemCountersBusData) * count;
     MemCountersBusData *out_data = (MemCountersBusData *)malloc(size);
     for (int i = 0; i < count; ++i) {
         out_data[i].addr = chunk_data[i].data[1];
         out_data[i].flags = chunk_data[i].data[3] + ((chunk_data[i].data[0] - 1) << 16);
     }
+    return out_data;
+}
+
+MemCountersBusData *compact_and_save(int chunk, BusDataChunk* chunk_data, int count) {
+    int size = sizeof(MemCountersBusData) * count;
+    MemCountersBusData *out_data = compact(chunk_data, count);
     char filename[256];
     snprintf(filename, sizeof(filename), "../bus_data/mem_count_data/mem_count_data_%d.bin", chunk);
     int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
@@ -101,59 +103,37 @@ void convert_to_compact(void){
     printf("chunks: %d  tot_chunks: %d\n", chunks, tot_chunks);
 }
 
-
-inline uint32_t addr_to_offset_2(uint32_t addr, uint32_t chunk_id = 0, uint32_t index = 0) {
-    switch((uint8_t)((addr >> 24) & 0xFE)) {
-        case 0x80: return ((addr - 0x80000000) >> (ADDR_LOW_BITS));
-        case 0x82: return ((addr - 0x82000000) >> (ADDR_LOW_BITS)) + ADDR_PAGE_SIZE;
-        case 0x84: return ((addr - 0x84000000) >> (ADDR_LOW_BITS)) + 2 * ADDR_PAGE_SIZE;
-        case 0x86: return ((addr - 0x86000000) >> (ADDR_LOW_BITS)) + 3 * ADDR_PAGE_SIZE;
-
-        case 0x90: return ((addr - 0x90000000) >> (ADDR_LOW_BITS)) + 4 * ADDR_PAGE_SIZE;
-        case 0x92: return ((addr - 0x92000000) >> (ADDR_LOW_BITS)) + 5 * ADDR_PAGE_SIZE;
-        case 0x94: return ((addr - 0x94000000) >> (ADDR_LOW_BITS)) + 6 * ADDR_PAGE_SIZE;
-        case 0x96: return ((addr - 0x96000000) >> (ADDR_LOW_BITS)) + 7 * ADDR_PAGE_SIZE;
-
-        case 0xA0: return ((addr - 0xA0000000) >> (ADDR_LOW_BITS)) + 8 * ADDR_PAGE_SIZE;
-        case 0xA2: return ((addr - 0xA2000000) >> (ADDR_LOW_BITS)) + 9 * ADDR_PAGE_SIZE;
-        case 0xA4: return ((addr - 0xA4000000) >> (ADDR_LOW_BITS)) + 10 * ADDR_PAGE_SIZE;
-        case 0xA6: return ((addr - 0xA6000000) >> (ADDR_LOW_BITS)) + 11 * ADDR_PAGE_SIZE;
-        case 0xA8: return ((addr - 0xA8000000) >> (ADDR_LOW_BITS)) + 12 * ADDR_PAGE_SIZE;
-        case 0xAA: return ((addr - 0xAA000000) >> (ADDR_LOW_BITS)) + 13 * ADDR_PAGE_SIZE;
-        case 0xAC: return ((addr - 0xAC000000) >> (ADDR_LOW_BITS)) + 14 * ADDR_PAGE_SIZE;
-        case 0xAE: return ((addr - 0xAE000000) >> (ADDR_LOW_BITS)) + 15 * ADDR_PAGE_SIZE;
-
-        case 0xB0: return ((addr - 0xB0000000) >> (ADDR_LOW_BITS)) + 16 * ADDR_PAGE_SIZE;
-        case 0xB2: return ((addr - 0xB2000000) >> (ADDR_LOW_BITS)) + 17 * ADDR_PAGE_SIZE;
-        case 0xB4: return ((addr - 0xB4000000) >> (ADDR_LOW_BITS)) + 18 * ADDR_PAGE_SIZE;
-        case 0xB6: return ((addr - 0xB6000000) >> (ADDR_LOW_BITS)) + 19 * ADDR_PAGE_SIZE;
-        case 0xB8: return ((addr - 0xB8000000) >> (ADDR_LOW_BITS)) + 20 * ADDR_PAGE_SIZE;
-        case 0xBA: return ((addr - 0xBA000000) >> (ADDR_LOW_BITS)) + 21 * ADDR_PAGE_SIZE;
-        case 0xBC: return ((addr - 0xBC000000) >> (ADDR_LOW_BITS)) + 22 * ADDR_PAGE_SIZE;
-        case 0xBE: return ((addr - 0xBE000000) >> (ADDR_LOW_BITS)) + 23 * ADDR_PAGE_SIZE;
-
-        case 0xC0: return ((addr - 0xC0000000) >> (ADDR_LOW_BITS)) + 24 * ADDR_PAGE_SIZE;
-        case 0xC2: return ((addr - 0xC2000000) >> (ADDR_LOW_BITS)) + 25 * ADDR_PAGE_SIZE;
-        case 0xC4: return ((addr - 0xC4000000) >> (ADDR_LOW_BITS)) + 26 * ADDR_PAGE_SIZE;
-        case 0xC6: return ((addr - 0xC6000000) >> (ADDR_LOW_BITS)) + 27 * ADDR_PAGE_SIZE;
-        case 0xC8: return ((addr - 0xC8000000) >> (ADDR_LOW_BITS)) + 28 * ADDR_PAGE_SIZE;
-        case 0xCA: return ((addr - 0xCA000000) >> (ADDR_LOW_BITS)) + 29 * ADDR_PAGE_SIZE;
-        case 0xCC: return ((addr - 0xCC000000) >> (ADDR_LOW_BITS)) + 30 * ADDR_PAGE_SIZE;
-        case 0xCE: return ((addr - 0xCE000000) >> (ADDR_LOW_BITS)) + 31 * ADDR_PAGE_SIZE;
-
-        case 0xD0: return ((addr - 0xD0000000) >> (ADDR_LOW_BITS)) + 32 * ADDR_PAGE_SIZE;
-        case 0xD2: return ((addr - 0xD2000000) >> (ADDR_LOW_BITS)) + 33 * ADDR_PAGE_SIZE;
-        case 0xD4: return ((addr - 0xD4000000) >> (ADDR_LOW_BITS)) + 34 * ADDR_PAGE_SIZE;
-        case 0xD6: return ((addr - 0xD6000000) >> (ADDR_LOW_BITS)) + 35 * ADDR_PAGE_SIZE;
-        case 0xD8: return ((addr - 0xD8000000) >> (ADDR_LOW_BITS)) + 36 * ADDR_PAGE_SIZE;
-        case 0xDA: return ((addr - 0xDA000000) >> (ADDR_LOW_BITS)) + 37 * ADDR_PAGE_SIZE;
-        case 0xDC: return ((addr - 0xDC000000) >> (ADDR_LOW_BITS)) + 38 * ADDR_PAGE_SIZE;
-        case 0xDE: return ((addr - 0xDE000000) >> (ADDR_LOW_BITS)) + 39 * ADDR_PAGE_SIZE;
+// same as convert_to_compact, but all chunks are written on one indexed trace file
+void convert_to_trace_file(const char *filename, bool checksum = true, bool encode = false) {
+    MemTraceFileWriter writer;
+    if (!writer.open(filename, checksum, encode)) {
+        return;
     }
-    printf("Error: addr_to_offset: 0x%X (%d:%d)\n", addr, chunk_id, index);
-    exit(1);
+    BusDataChunk *chunk_data = NULL;
+    int chunk_size;
+    int chunks = 0;
+    int tot_chunks = 0;
+    while (chunks < MAX_CHUNKS && (chunk_size = load_from_file(chunks, &chunk_data)) >=0) {
+        printf("converting chunk %d with size %d\n", chunks, chunk_size);
+        MemCountersBusData *out_data = compact(chunk_data, chunk_size);
+        bool done = writer.add_chunk(out_data, chunk_size);
+        free(out_data);
+        free(chunk_data);
+        if (!done) break;
+        chunks++;
+        tot_chunks += chunk_size;
+    }
+    writer.close();
+    printf("chunks: %d  tot_chunks: %d file: %s\n", chunks, tot_chunks, filename);
 }
 
+// packs an existing directory of mem_count_data_N.bin files on one indexed trace file
+void pack_compact_to_trace_file(const char *path, const char *filename, bool checksum = true, bool encode = false) {
+    int32_t chunks = MemTraceFileWriter::pack_directory(path, filename, checksum, encode);
+    printf("chunks: %d file: %s\n", chunks, filename);
+}
+
+
 inline uint32_t addr_to_page_2(uint32_t addr, uint32_t chunk_id = 0, uint32_t index = 0) {
     switch((uint8_t)((addr >> 24) & 0xFE)) {
         case 0x80: return 0;
@@ -9,6 +9,12 @@
 #include <time.h>
 #include <sys/time.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <stdexcept>
+#include <sstream>
+#include <vector>
+#include <thread>
+#include <algorithm>
 
 #include "mem_types.hpp"
 
@@ -18,6 +24,47 @@ inline uint64_t get_usec() {
     return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
 }
 
+// anonymous mapping, pages are zero-filled by kernel on first touch, untouched pages cost nothing.
+inline void *lazy_alloc(size_t size) {
+    void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED) {
+        std::ostringstream msg;
+        msg << "ERROR: lazy_alloc " << size << " bytes";
+        throw std::runtime_error(msg.str());
+    }
+    return addr;
+}
+
+inline void lazy_free(void *addr, size_t size) {
+    if (addr != nullptr) {
+        munmap(addr, size);
+    }
+}
+
+#define LAZY_RELEASE_MIN_BYTES (1 << 21)
+
+// zero a range of a lazy_alloc mapping, whole pages of large ranges are returned to kernel
+// (zero-filled again on next touch), only edges are written.
+inline void lazy_zero(void *addr, size_t size) {
+    if (size < LAZY_RELEASE_MIN_BYTES) {
+        memset(addr, 0, size);
+        return;
+    }
+    const uintptr_t page_size = 4096;
+    uintptr_t from = (uintptr_t)addr;
+    uintptr_t to = from + size;
+    uintptr_t page_from = (from + page_size - 1) & ~(page_size - 1);
+    uintptr_t page_to = to & ~(page_size - 1);
+    memset(addr, 0, page_from - from);
+    madvise((void *)page_from, page_to - page_from, MADV_DONTNEED);
+    memset((void *)page_to, 0, to - page_to);
+}
+
+// threads to run a parallel stage, limited by hardware threads, at least 1
+inline uint32_t parallel_threads(uint32_t threads) {
+    return std::max(1U, std::min(threads, std::thread::hardware_concurrency()));
+}
+
 inline int32_t load_from_compact_file(const char *path, size_t chunk_id, MemCountersBusData** chunk) {
     char filename[256];
     snprintf(filename, sizeof(filename), "%s/mem_count_data_%ld.bin", path, chunk_id);